@@ -0,0 +1,255 @@
+/*
+ * Headless benchmark for subsamplegraph, no display needed.
+ *
+ * Measures ingest throughput, render latency over zoom levels and viewport sizes, cold and warm page cache, and
+ * open/teardown cost. Results go to stdout as one JSON object per line, progress to stderr.
+ *
+ * The render dataset <base>.ssg is kept between runs, so large datasets are only generated once.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "subsamplegraph.h"
+
+#define INGEST_BLOCK 4000
+
+static float fBrownianWalk = 0.0f;
+static uint64_t iSamplesGenerated = 0;
+
+static float nextRandomSample() {
+  fBrownianWalk += ((rand() & 8191)-4096) * 0.002f;
+  fBrownianWalk *= (0.6+0.4*cos(iSamplesGenerated*0.0003));
+  iSamplesGenerated++;
+  return fBrownianWalk;
+}
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int compareDouble(const void *a, const void *b) {
+  double d = *(const double*)a - *(const double*)b;
+  return (d > 0) - (d < 0);
+}
+
+// Write back and evict the file from the page cache, so the next access reads from disk
+static int dropFileCache(const char *pcFilename) {
+  int fd = open(pcFilename, O_RDONLY);
+  if (fd < 0) return -1;
+  fdatasync(fd);
+  int iRet = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  close(fd);
+  return iRet == 0 ? 0 : -1;
+}
+
+// Read the whole file into the page cache
+static void loadFileCache(const char *pcFilename) {
+  static char acBuffer[1<<20];
+  int fd = open(pcFilename, O_RDONLY);
+  if (fd < 0) return;
+  while (read(fd, acBuffer, sizeof(acBuffer)) > 0);
+  close(fd);
+}
+
+static void removeGraph(const char *pcBasefilename) {
+  char acFilename[1024];
+  snprintf(acFilename, sizeof(acFilename), "%s.ssg", pcBasefilename);
+  unlink(acFilename);
+}
+
+static void benchIngest(const char *pcBasefilename, uint64_t iSamples) {
+  char acBasefilename[1024];
+  float afBlock[INGEST_BLOCK];
+  uint64_t i;
+  int j;
+  double t;
+
+  snprintf(acBasefilename, sizeof(acBasefilename), "%s_ingest", pcBasefilename);
+
+  removeGraph(acBasefilename);
+  SSG *pSSG = SSG_New(acBasefilename, 1);
+  if (pSSG == NULL) return;
+  t = now();
+  for (i = 0; i < iSamples; i++) SSG_AddValue(pSSG, nextRandomSample());
+  t = now() - t;
+  printf("{\"bench\":\"ingest\",\"mode\":\"per_sample\",\"samples\":%llu,\"seconds\":%.6f,\"msamples_per_s\":%.3f}\n",
+         (unsigned long long)iSamples, t, iSamples / t * 1e-6);
+  SSG_Teardown(pSSG);
+
+  removeGraph(acBasefilename);
+  pSSG = SSG_New(acBasefilename, 1);
+  if (pSSG == NULL) return;
+  t = 0.0;
+  for (i = 0; i < iSamples; i += INGEST_BLOCK) {
+    int iCount = (int)(iSamples - i < INGEST_BLOCK ? iSamples - i : INGEST_BLOCK);
+    for (j = 0; j < iCount; j++) afBlock[j] = nextRandomSample();
+    double t0 = now();
+    SSG_AddValues(pSSG, afBlock, iCount);
+    t += now() - t0;
+  }
+  printf("{\"bench\":\"ingest\",\"mode\":\"batched\",\"block\":%d,\"samples\":%llu,\"seconds\":%.6f,\"msamples_per_s\":%.3f}\n",
+         INGEST_BLOCK, (unsigned long long)iSamples, t, iSamples / t * 1e-6);
+  SSG_Teardown(pSSG);
+  removeGraph(acBasefilename);
+}
+
+// Make sure <base>.ssg holds at least iSamples samples, generating the missing ones
+static int prepareDataset(const char *pcBasefilename, uint64_t iSamples) {
+  float afBlock[INGEST_BLOCK];
+  int j;
+
+  SSG *pSSG = SSG_New((char*)pcBasefilename, 1);
+  if (pSSG == NULL) return -1;
+  uint64_t iLength = SSG_GetLength(pSSG);
+  if (iLength < iSamples) {
+    fprintf(stderr, "Generating %llu samples in %s.ssg\n", (unsigned long long)(iSamples - iLength), pcBasefilename);
+    iSamplesGenerated = iLength;
+    while (iLength < iSamples) {
+      int iCount = (int)(iSamples - iLength < INGEST_BLOCK ? iSamples - iLength : INGEST_BLOCK);
+      for (j = 0; j < iCount; j++) afBlock[j] = nextRandomSample();
+      SSG_AddValues(pSSG, afBlock, iCount);
+      iLength += iCount;
+    }
+  }
+  int iRet = SSG_Flush(pSSG, 1);
+  SSG_Teardown(pSSG);
+  return iRet;
+}
+
+static void benchOpen(const char *pcBasefilename, const char *pcFilename, int iRepeats) {
+  int i, bCold;
+  for (bCold = 1; bCold >= 0; bCold--) {
+    double tOpen = 0.0, tTeardown = 0.0;
+    uint64_t iLength = 0;
+    for (i = 0; i < iRepeats; i++) {
+      if (bCold) dropFileCache(pcFilename);
+      double t = now();
+      SSG *pSSG = SSG_New((char*)pcBasefilename, 0);
+      tOpen += now() - t;
+      if (pSSG == NULL) return;
+      iLength = SSG_GetLength(pSSG);
+      t = now();
+      SSG_Teardown(pSSG);
+      tTeardown += now() - t;
+    }
+    printf("{\"bench\":\"open\",\"cache\":\"%s\",\"samples\":%llu,\"open_us\":%.1f,\"teardown_us\":%.1f}\n",
+           bCold ? "cold" : "warm", (unsigned long long)iLength, tOpen / iRepeats * 1e6, tTeardown / iRepeats * 1e6);
+  }
+}
+
+// Render latency at zoom levels from below one sample per pixel up to the whole dataset in one viewport.
+// Every frame goes to a random position, so warm frames measure rendering and not a single hot spot.
+static void benchRender(const char *pcBasefilename, const char *pcFilename, int iWidth, int iHeight, int iRepeats) {
+  double *pdTimes = malloc(iRepeats * sizeof(double));
+  uint8_t *pBuffer = malloc((size_t)iWidth * iHeight);
+  int i;
+
+  SSG *pSSG = SSG_New((char*)pcBasefilename, 0);
+  if (pSSG == NULL || pdTimes == NULL || pBuffer == NULL) goto DONE;
+  uint64_t iLength = SSG_GetLength(pSSG);
+  double dMaxSamplesPerPixel = (double)iLength / iWidth;
+
+  double dSamplesPerPixel;
+  for (dSamplesPerPixel = 0.25; dSamplesPerPixel <= dMaxSamplesPerPixel * 1.0001; dSamplesPerPixel *= 4.0) {
+    double dSpan = dSamplesPerPixel * iWidth;
+    float fTop, fBottom;
+    srand(1);
+
+    // Cold: first frame after evicting the file, on a freshly opened graph
+    SSG_Teardown(pSSG);
+    dropFileCache(pcFilename);
+    pSSG = SSG_New((char*)pcBasefilename, 0);
+    if (pSSG == NULL) goto DONE;
+    SSG_EnableStats(pSSG, 1);
+    double dLeft = (double)(iLength - dSpan) * (rand() / (double)RAND_MAX);
+    if (SSG_AutoRange(pSSG, dLeft, dLeft + dSpan, &fTop, &fBottom) != 0) {
+      fTop = 300.0f;
+      fBottom = -300.0f;
+    }
+    double t = now();
+    SSG_Render(pSSG, dLeft, dLeft + dSpan, fTop, fBottom, pBuffer, iWidth, iHeight);
+    double tCold = now() - t;
+    SSG_Stats stats;
+    SSG_GetStats(pSSG, &stats);
+
+    // Warm: the whole file is cached, only the graph's first touch of a page costs a minor fault
+    loadFileCache(pcFilename);
+    for (i = 0; i < iRepeats; i++) {
+      dLeft = (double)(iLength - dSpan) * (rand() / (double)RAND_MAX);
+      t = now();
+      SSG_Render(pSSG, dLeft, dLeft + dSpan, fTop, fBottom, pBuffer, iWidth, iHeight);
+      pdTimes[i] = now() - t;
+    }
+    qsort(pdTimes, iRepeats, sizeof(double), compareDouble);
+    printf("{\"bench\":\"render\",\"width\":%d,\"height\":%d,\"samples_per_pixel\":%.2f,\"lod\":%d,\"cold_us\":%.1f,"
+           "\"cold_major_faults\":%llu,\"warm_median_us\":%.1f,\"warm_min_us\":%.1f,\"warm_p95_us\":%.1f}\n",
+           iWidth, iHeight, dSamplesPerPixel, stats.iLastLod, tCold * 1e6, (unsigned long long)stats.iRenderMajorFaults,
+           pdTimes[iRepeats / 2] * 1e6, pdTimes[0] * 1e6, pdTimes[iRepeats * 95 / 100] * 1e6);
+    fflush(stdout);
+  }
+
+DONE:
+  if (pSSG != NULL) SSG_Teardown(pSSG);
+  free(pBuffer);
+  free(pdTimes);
+}
+
+static void usage(const char *pcName) {
+  fprintf(stderr, "Usage: %s [-f basefilename] [-n samples] [-i ingest samples] [-r repeats]\n", pcName);
+  fprintf(stderr, "  -f  Dataset base filename, default bench. <base>.ssg is kept and reused.\n");
+  fprintf(stderr, "  -n  Samples in the render dataset, default 100000000\n");
+  fprintf(stderr, "  -i  Samples added in the ingest benchmarks, default 10000000, 0 to skip them\n");
+  fprintf(stderr, "  -r  Frames rendered per zoom level and viewport size, default 50\n");
+}
+
+int main(int argc, char* argv[]) {
+  static const int aiViewports[][2] = { {256, 85}, {1024, 341}, {2048, 682}, {3840, 1080} };
+  const char *pcBasefilename = "bench";
+  uint64_t iSamples = 100000000;
+  uint64_t iIngestSamples = 10000000;
+  int iRepeats = 50;
+  char acFilename[1024];
+  int i, iOpt;
+
+  while ((iOpt = getopt(argc, argv, "f:n:i:r:h")) != -1) {
+    switch (iOpt) {
+      case 'f': pcBasefilename = optarg; break;
+      case 'n': iSamples = strtoull(optarg, NULL, 0); break;
+      case 'i': iIngestSamples = strtoull(optarg, NULL, 0); break;
+      case 'r': iRepeats = atoi(optarg); break;
+      default:  usage(argv[0]); return iOpt == 'h' ? 0 : 1;
+    }
+  }
+  if (iSamples == 0 || iRepeats < 1) {
+    usage(argv[0]);
+    return 1;
+  }
+  snprintf(acFilename, sizeof(acFilename), "%s.ssg", pcBasefilename);
+
+  if (iIngestSamples > 0) {
+    fprintf(stderr, "Ingest...\n");
+    benchIngest(pcBasefilename, iIngestSamples);
+  }
+
+  if (prepareDataset(pcBasefilename, iSamples) != 0) {
+    fprintf(stderr, "Can't prepare %s\n", acFilename);
+    return 1;
+  }
+  fprintf(stderr, "Open/teardown...\n");
+  benchOpen(pcBasefilename, acFilename, iRepeats);
+
+  for (i = 0; i < (int)(sizeof(aiViewports) / sizeof(aiViewports[0])); i++) {
+    fprintf(stderr, "Render %dx%d...\n", aiViewports[i][0], aiViewports[i][1]);
+    benchRender(pcBasefilename, acFilename, aiViewports[i][0], aiViewports[i][1], iRepeats);
+  }
+  return 0;
+}
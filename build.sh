@@ -1 +1 @@
-gcc -o testsubsamplegraph main.c subsamplegraph.c -lm `sdl2-config --cflags --libs`
+gcc -o testsubsamplegraph main.c subsamplegraph.c -lm -lpthread `sdl2-config --cflags --libs`
@@ -0,0 +1,790 @@
+/*
+ * Correctness checks for subsamplegraph, run by ctest.
+ *
+ * Each check builds its graphs in the working directory, removes them again, prints one JSON object per line to
+ * stdout and returns 0 if it passed. Run without arguments for all checks, or with the names of some.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "subsamplegraph.h"
+
+#define MIN(a,b) ((a)<(b)?(a):(b))
+#define MAX(a,b) ((a)>(b)?(a):(b))
+
+#define INGEST_BLOCK 4000
+#define REF_LEVELS 24               // levels of the reference pyramid, the original MAX_MIP_LOD
+#define RENDER_SAMPLES 1000000      // samples of the render checks
+#define RENDER_VIEWS 400            // random viewports compared per check
+#define EDIT_SAMPLES 300000         // samples of each edited graph
+#define EDITS 200                   // SSG_SetValues/SSG_SetFrames calls on it
+#define RETAIN_SAMPLES 200000       // kept samples of the retention check
+#define RETAIN_ROUNDS 40            // appends of the retention check, each followed by queries
+#define REOPEN_COMMITTED 500000     // samples committed before the simulated crash
+#define REOPEN_LOST 300000          // samples added after the commit, lost in the crash
+#define VIEW_MAX_WIDTH 700
+#define VIEW_MAX_HEIGHT 400
+#define EDIT_DENSITY_MAX_DIFF 2     // gray levels an edited density render may differ by from a fresh one, the
+                                    // moments of the repaired entries are summed in another order
+#define DENSITY_SAMPLES 2000000     // noise samples of each density graph
+#define DENSITY_OFFSET 1e5          // added to the second signal of the density check
+#define DENSITY_MAX_DIFF 32         // gray levels a pixel of the two density renders may differ by, the faint
+                                    // ones step by 16 and more through the gamma
+#define DENSITY_MAX_MEAN_DIFF 0.25  // and all of them on average
+
+static void removeGraph(const char *pcBasefilename) {
+  char acFilename[1024];
+  snprintf(acFilename, sizeof(acFilename), "%s.ssg", pcBasefilename);
+  unlink(acFilename);
+}
+
+// Standard normal noise, Box-Muller from rand()
+static float nextNoiseSample() {
+  double u1 = (rand() + 1.0) / ((double)RAND_MAX + 2.0);
+  double u2 = rand() / ((double)RAND_MAX + 1.0);
+  return (float)(sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2));
+}
+
+// Density graph of iSamples noise samples plus dOffset, rendered whole over +-5 around dOffset into pBuffer
+static int renderNoiseDensity(const char *pcBasefilename, uint64_t iSamples, double dOffset, uint8_t *pBuffer, int iWidth, int iHeight) {
+  SSG_Options options = { 0 };
+  float afBlock[INGEST_BLOCK];
+  uint64_t i;
+  int j;
+
+  options.bDensity = 1;
+  removeGraph(pcBasefilename);
+  SSG *pSSG = SSG_NewEx((char*)pcBasefilename, 1, &options);
+  if (pSSG == NULL) return -1;
+  srand(1);
+  for (i = 0; i < iSamples; i += INGEST_BLOCK) {
+    int iCount = (int)(iSamples - i < INGEST_BLOCK ? iSamples - i : INGEST_BLOCK);
+    for (j = 0; j < iCount; j++) afBlock[j] = (float)(nextNoiseSample() + dOffset);
+    SSG_AddValues(pSSG, afBlock, iCount);
+  }
+  SSG_RenderDensity(pSSG, 0.0, (double)iSamples, (float)(dOffset + 5.0), (float)(dOffset - 5.0), pBuffer, iWidth, iHeight);
+  SSG_Teardown(pSSG);
+  removeGraph(pcBasefilename);
+  return 0;
+}
+
+// Density renders of the same noise with and without a large offset must match up to the float rounding of the
+// offset samples.
+static int checkDensityOffset(void) {
+  int iWidth = 1024, iHeight = 256, iMaxDiff = 0, i;
+  uint8_t *pPlain = malloc((size_t)iWidth * iHeight);
+  uint8_t *pOffset = malloc((size_t)iWidth * iHeight);
+  double dSumDiff = 0.0;
+  int iRet = -1;
+
+  if (pPlain == NULL || pOffset == NULL || renderNoiseDensity("check_density", DENSITY_SAMPLES, 0.0, pPlain, iWidth, iHeight) != 0 ||
+      renderNoiseDensity("check_density", DENSITY_SAMPLES, DENSITY_OFFSET, pOffset, iWidth, iHeight) != 0) {
+    goto DONE;
+  }
+  for (i = 0; i < iWidth * iHeight; i++) {
+    int iDiff = abs((int)pPlain[i] - (int)pOffset[i]);
+    iMaxDiff = iDiff > iMaxDiff ? iDiff : iMaxDiff;
+    dSumDiff += iDiff;
+  }
+  iRet = (iMaxDiff <= DENSITY_MAX_DIFF && dSumDiff / (iWidth * iHeight) <= DENSITY_MAX_MEAN_DIFF) ? 0 : -1;
+  printf("{\"check\":\"density_offset\",\"samples\":%d,\"offset\":%g,\"max_diff\":%d,\"mean_diff\":%.3f,\"ok\":%s}\n",
+         DENSITY_SAMPLES, DENSITY_OFFSET, iMaxDiff, dSumDiff / (iWidth * iHeight), iRet == 0 ? "true" : "false");
+
+DONE:
+  free(pPlain);
+  free(pOffset);
+  return iRet;
+}
+
+// Viewport of a render, see randomView
+typedef struct {
+  double dLeft, dRight;
+  float fTop, fBottom;
+  int iWidth, iHeight;
+} View;
+
+// Min/max pyramid the way the original per-sample SSG_AddValue built it, level 0 being the raw samples
+typedef struct {
+  const float *apfMin[REF_LEVELS];
+  const float *apfMax[REF_LEVELS];
+  uint64_t aiLength[REF_LEVELS];
+} RefPyramid;
+
+// Brownian walk like the benchmark's, iSeed selects the walk
+static void fillWalk(float *pfValues, uint64_t iCount, unsigned int iSeed) {
+  float fWalk = 0.0f;
+  uint64_t i;
+  srand(iSeed);
+  for (i = 0; i < iCount; i++) {
+    fWalk += ((rand() & 8191)-4096) * 0.002f;
+    fWalk *= (float)(0.6+0.4*cos(i*0.0003));
+    pfValues[i] = fWalk;
+  }
+}
+
+// Value of sample i of channel c, cheap enough to recompute for brute force queries
+static float hashSample(uint64_t i, int c) {
+  return (float)((i*2654435761u + c*977) % 20011) - 10000.0f;
+}
+
+// Random viewport at 2^dMinLog2 to 2^dMaxLog2 samples per pixel, its right edge between dMinRight and dMaxRight
+static void randomView(View *pView, double dMinLog2, double dMaxLog2, double dMinRight, double dMaxRight) {
+  double dSamplesPerPixel = pow(2.0, dMinLog2 + (dMaxLog2 - dMinLog2) * (rand() / (double)RAND_MAX));
+  pView->iWidth = 1 + rand() % VIEW_MAX_WIDTH;
+  pView->iHeight = 1 + rand() % VIEW_MAX_HEIGHT;
+  pView->dRight = dMinRight + (dMaxRight - dMinRight) * (rand() / (double)RAND_MAX);
+  pView->dLeft = pView->dRight - dSamplesPerPixel * pView->iWidth;
+  pView->fTop = (float)(1 + rand() % 200);
+  pView->fBottom = -(float)(rand() % 200);
+}
+
+static void render(SSG *pSSG, const View *pView, uint8_t *pBuffer) {
+  SSG_Render(pSSG, pView->dLeft, pView->dRight, pView->fTop, pView->fBottom, pBuffer, pView->iWidth, pView->iHeight);
+}
+
+// Renders and queries of two graphs over random views with right edges from dMinRight to dMaxRight must match.
+// Returns the number of views that didn't, density renders may differ by iDensityMaxDiff per pixel.
+static int compareGraphs(SSG *pA, SSG *pB, int iViews, double dMaxLog2, double dMinRight, double dMaxRight, int iDensityMaxDiff, uint8_t *pBufferA, uint8_t *pBufferB) {
+  float afMinA[SSG_MAX_CHANNELS], afMaxA[SSG_MAX_CHANNELS], afMinB[SSG_MAX_CHANNELS], afMaxB[SSG_MAX_CHANNELS];
+  uint64_t iFirst = SSG_GetFirstSample(pA), iLength = SSG_GetLength(pA);
+  int iChannels = SSG_GetChannels(pA), iMismatches = 0, i, j;
+
+  for (i = 0; i < iViews; i++) {
+    View view;
+    int bMismatch = 0;
+    randomView(&view, -4.0, dMaxLog2, dMinRight, dMaxRight);
+    render(pA, &view, pBufferA);
+    render(pB, &view, pBufferB);
+    bMismatch |= memcmp(pBufferA, pBufferB, (size_t)view.iWidth * view.iHeight) != 0;
+    if (iDensityMaxDiff >= 0) {
+      SSG_RenderDensity(pA, view.dLeft, view.dRight, view.fTop, view.fBottom, pBufferA, view.iWidth, view.iHeight);
+      SSG_RenderDensity(pB, view.dLeft, view.dRight, view.fTop, view.fBottom, pBufferB, view.iWidth, view.iHeight);
+      for (j = 0; j < view.iWidth * view.iHeight; j++) bMismatch |= abs((int)pBufferA[j] - (int)pBufferB[j]) > iDensityMaxDiff;
+    }
+    uint64_t iStart = iFirst + (uint64_t)(rand() / ((double)RAND_MAX + 1.0) * (iLength - iFirst));
+    uint64_t iEnd = iStart + 1 + (uint64_t)(rand() / ((double)RAND_MAX + 1.0) * (iLength - iStart));
+    bMismatch |= SSG_QueryRange(pA, iStart, iEnd, afMinA, afMaxA) != SSG_QueryRange(pB, iStart, iEnd, afMinB, afMaxB) ||
+                 memcmp(afMinA, afMinB, iChannels * sizeof(float)) != 0 || memcmp(afMaxA, afMaxB, iChannels * sizeof(float)) != 0;
+    iMismatches += bMismatch;
+  }
+  return iMismatches;
+}
+
+// New graph holding iFrames frames of pfFrames
+static SSG *newGraph(const char *pcBasefilename, const SSG_Options *pOptions, const float *pfFrames, uint64_t iFrames) {
+  removeGraph(pcBasefilename);
+  SSG *pSSG = SSG_NewEx((char*)pcBasefilename, 1, pOptions);
+  if (pSSG != NULL && iFrames > 0) SSG_AddFrames(pSSG, pfFrames, iFrames);
+  return pSSG;
+}
+
+static int buildRefPyramid(RefPyramid *pRef, const float *pfValues, uint64_t iCount) {
+  uint64_t i;
+  int iLevel;
+
+  memset(pRef, 0, sizeof(*pRef));
+  pRef->apfMin[0] = pRef->apfMax[0] = pfValues;
+  pRef->aiLength[0] = iCount;
+  for (iLevel = 1; iLevel < REF_LEVELS; iLevel++) {
+    uint64_t iLength = pRef->aiLength[iLevel-1] / 2;
+    float *pfMin = malloc((iLength + 1) * sizeof(float));
+    float *pfMax = malloc((iLength + 1) * sizeof(float));
+    pRef->apfMin[iLevel] = pfMin;
+    pRef->apfMax[iLevel] = pfMax;
+    if (pfMin == NULL || pfMax == NULL) return -1;
+    for (i = 0; i < iLength; i++) {
+      pfMin[i] = MIN(pRef->apfMin[iLevel-1][2*i], pRef->apfMin[iLevel-1][2*i+1]);
+      pfMax[i] = MAX(pRef->apfMax[iLevel-1][2*i], pRef->apfMax[iLevel-1][2*i+1]);
+    }
+    pRef->aiLength[iLevel] = iLength;
+  }
+  return 0;
+}
+
+static void freeRefPyramid(RefPyramid *pRef) {
+  int iLevel;
+  for (iLevel = 1; iLevel < REF_LEVELS; iLevel++) {
+    free((float*)pRef->apfMin[iLevel]);
+    free((float*)pRef->apfMax[iLevel]);
+  }
+}
+
+static void refSample(const RefPyramid *pRef, int64_t iSamplePos, int iLevel, float *pfOutMin, float *pfOutMax) {
+  *pfOutMin = 0.0f;
+  *pfOutMax = 0.0f;
+  if (iLevel >= REF_LEVELS || iSamplePos < 0 || (uint64_t)iSamplePos >= pRef->aiLength[iLevel]) return;
+  *pfOutMin = pRef->apfMin[iLevel][iSamplePos];
+  *pfOutMax = pRef->apfMax[iLevel][iSamplePos];
+}
+
+static int refLinear(float v1, float v2, float f) {
+  int iv = 255.0f * (v1+(v2-v1)*f);
+  return iv;
+}
+
+// The original SSG_Render, one pixel at a time, which the rasterizers, the tiled mode, the 64-bit positions and
+// the growing pyramid must all reproduce byte for byte
+static void refRender(const RefPyramid *pRef, const View *pView, uint8_t *pDstBuffer) {
+  int iWidth = pView->iWidth, iHeight = pView->iHeight;
+  uint8_t aiGammaxlat[256];
+  int x,y,i;
+
+  for (i = 0; i < 256; i++) aiGammaxlat[i] = (uint8_t)sqrt(256*i);
+
+  double dSamplesPerPixel = (pView->dRight - pView->dLeft) / (double)iWidth;
+
+  float fUnitsPerPixel = (pView->fTop - pView->fBottom) / (float)iHeight;
+  float fZeroAtYPixel = (float)iHeight * pView->fTop / (pView->fTop - pView->fBottom);
+
+  float fLOD = (float)(log(dSamplesPerPixel) / log(2.0) - 0.0);
+  if (fLOD<0.0f) fLOD=0.0f;
+  int iLOD = (int)fLOD;
+  float fFracLod = fLOD - iLOD;
+  float fLodScale = (1.0f/(1<<iLOD));
+
+  float fPixelsPerUnit = 1.0f / fUnitsPerPixel;
+  double dSamplePos = pView->dLeft;
+
+  for (x=0; x<iWidth; x++) {
+    double dBaseLodSamplePos = dSamplePos * fLodScale;
+    double dNextLodSamplePos = dBaseLodSamplePos * 0.5 - 0.5;
+
+    int iBaseLodSamplePos = (int)dBaseLodSamplePos;
+    int iNextLodSamplePos = (int)dNextLodSamplePos;
+    float fBaseLodSamplePosFrac = (float)(dBaseLodSamplePos - iBaseLodSamplePos);
+    float fNextLodSamplePosFrac = (float)(dNextLodSamplePos - iNextLodSamplePos);
+
+    if (dSamplesPerPixel < 1.0) {
+      float v1, v2;
+      refSample(pRef, (int64_t)(dSamplePos - dSamplesPerPixel), 0, &v1, &v1); v1 = fZeroAtYPixel - fPixelsPerUnit * v1;
+      refSample(pRef, (int64_t) dSamplePos                    , 0, &v2, &v2); v2 = fZeroAtYPixel - fPixelsPerUnit * v2;
+      int miny = (int)MIN(v1,v2);
+      int maxy = (int)MAX(v1,v2);
+      for (y=0; y<iHeight; y++) {
+        pDstBuffer[y*iWidth + x] = (uint8_t)((miny<=y && y<=maxy) ? 255 : 0);
+      }
+    } else {
+      float afBaseMin[3], afBaseMax[3];
+      float afNextMin[3], afNextMax[3];
+      for (i = 0; i < 3; i++) {
+        refSample(pRef, iBaseLodSamplePos + i, iLOD    , &afBaseMin[i], &afBaseMax[i]);
+        refSample(pRef, iNextLodSamplePos + i, iLOD + 1, &afNextMin[i], &afNextMax[i]);
+        afBaseMin[i] = fZeroAtYPixel - fPixelsPerUnit * afBaseMin[i];
+        afBaseMax[i] = fZeroAtYPixel - fPixelsPerUnit * afBaseMax[i];
+        afNextMin[i] = fZeroAtYPixel - fPixelsPerUnit * afNextMin[i];
+        afNextMax[i] = fZeroAtYPixel - fPixelsPerUnit * afNextMax[i];
+      }
+      for (y = 0; y < iHeight; y++) {
+        int v02 = ((((int) MIN(afBaseMax[0],afBaseMin[1])) <= y) && (y <= ((int) MAX(afBaseMin[0],afBaseMax[1])))) ? 1 : 0;
+        int v03 = ((((int) MIN(afBaseMax[1],afBaseMin[2])) <= y) && (y <= ((int) MAX(afBaseMin[1],afBaseMax[2])))) ? 1 : 0;
+        int v12 = ((((int) MIN(afNextMax[0],afNextMin[1])) <= y) && (y <= ((int) MAX(afNextMin[0],afNextMax[1])))) ? 1 : 0;
+        int v13 = ((((int) MIN(afNextMax[1],afNextMin[2])) <= y) && (y <= ((int) MAX(afNextMin[1],afNextMax[2])))) ? 1 : 0;
+
+        int iv0 = refLinear(v02, v03, fBaseLodSamplePosFrac);
+        int iv1 = refLinear(v12, v13, fNextLodSamplePosFrac);
+
+        uint8_t iv = (uint8_t)(iv0 + (iv1 - iv0) * fFracLod);
+        iv = aiGammaxlat[iv];
+
+        pDstBuffer[y * iWidth + x] = iv;
+      }
+    }
+    dSamplePos += dSamplesPerPixel;
+  }
+}
+
+// SSG_Render, single-threaded and tiled, against the original renderer over a pyramid built in memory. The graph
+// is fed in blocks of mixed sizes and single samples, so all ingest paths have to build the same levels.
+static int checkRenderReference(void) {
+  float *pfValues = malloc(RENDER_SAMPLES * sizeof(float));
+  uint8_t *pRef = malloc(VIEW_MAX_WIDTH * VIEW_MAX_HEIGHT);
+  uint8_t *pOut = malloc(VIEW_MAX_WIDTH * VIEW_MAX_HEIGHT);
+  SSG_WorkerPool *pPool = SSG_WorkerPoolNew(4);
+  SSG *pSSG = NULL;
+  RefPyramid ref;
+  int iMismatches = 0, iTiledMismatches = 0, i, iRet = -1;
+  uint64_t iAdded = 0;
+
+  memset(&ref, 0, sizeof(ref));
+  if (pfValues == NULL || pRef == NULL || pOut == NULL || pPool == NULL) goto DONE;
+  fillWalk(pfValues, RENDER_SAMPLES, 1);
+  if (buildRefPyramid(&ref, pfValues, RENDER_SAMPLES) != 0) goto DONE;
+  removeGraph("check_render");
+  pSSG = SSG_New("check_render", 1);
+  if (pSSG == NULL) goto DONE;
+  srand(2);
+  while (iAdded < RENDER_SAMPLES) {
+    uint64_t iCount = (uint64_t)(rand() % 5000);
+    iCount = MIN(iCount, RENDER_SAMPLES - iAdded);
+    if (iCount == 0) {
+      SSG_AddValue(pSSG, pfValues[iAdded++]);
+    } else {
+      SSG_AddValues(pSSG, pfValues + iAdded, iCount);
+      iAdded += iCount;
+    }
+  }
+
+  for (i = 0; i < RENDER_VIEWS; i++) {
+    View view;
+    randomView(&view, -4.0, 20.0, 0.0, RENDER_SAMPLES * 1.25);
+    refRender(&ref, &view, pRef);
+    SSG_SetWorkerPool(pSSG, NULL);
+    render(pSSG, &view, pOut);
+    iMismatches += memcmp(pRef, pOut, (size_t)view.iWidth * view.iHeight) != 0;
+    SSG_SetWorkerPool(pSSG, pPool);
+    render(pSSG, &view, pOut);
+    iTiledMismatches += memcmp(pRef, pOut, (size_t)view.iWidth * view.iHeight) != 0;
+  }
+  SSG_SetWorkerPool(pSSG, NULL);
+  iRet = (iMismatches == 0 && iTiledMismatches == 0) ? 0 : -1;
+  printf("{\"check\":\"render_reference\",\"samples\":%d,\"views\":%d,\"mismatches\":%d,\"tiled_mismatches\":%d,\"ok\":%s}\n",
+         RENDER_SAMPLES, RENDER_VIEWS, iMismatches, iTiledMismatches, iRet == 0 ? "true" : "false");
+
+DONE:
+  if (pSSG != NULL) SSG_Teardown(pSSG);
+  if (pPool != NULL) SSG_WorkerPoolTeardown(pPool);
+  removeGraph("check_render");
+  freeRefPyramid(&ref);
+  free(pfValues);
+  free(pRef);
+  free(pOut);
+  return iRet;
+}
+
+// SSG_RenderCached following appends, panning by whole pixels and zooming must draw what a fresh cache draws
+static int checkRenderCached(void) {
+  int iWidth = 1024, iHeight = 256, iFrames = 600, iMismatches = 0, i;
+  float *pfValues = malloc((RENDER_SAMPLES + 300 * iFrames) * sizeof(float));
+  uint8_t *pCached = malloc((size_t)iWidth * iHeight);
+  uint8_t *pFresh = malloc((size_t)iWidth * iHeight);
+  SSG_RenderCache *pCache = SSG_RenderCacheNew();
+  SSG *pSSG = NULL;
+  uint64_t iLength = RENDER_SAMPLES;
+  double dSamplesPerPixel = 97.0, dPan = 0.0;
+  int iRet = -1;
+
+  if (pfValues == NULL || pCached == NULL || pFresh == NULL || pCache == NULL) goto DONE;
+  fillWalk(pfValues, RENDER_SAMPLES + 300 * iFrames, 3);
+  pSSG = newGraph("check_cached", NULL, pfValues, RENDER_SAMPLES);
+  if (pSSG == NULL) goto DONE;
+  srand(4);
+  for (i = 0; i < iFrames; i++) {
+    int iCount = rand() % 300;
+    SSG_AddValues(pSSG, pfValues + iLength, iCount);
+    iLength += iCount;
+    if (i % 100 == 99) dSamplesPerPixel *= 1.7;
+    if (i % 10 == 0) dPan = (rand() % 2) ? 0.0 : (rand() % 2000) * dSamplesPerPixel;
+    double dRight = iLength - dPan;
+    SSG_RenderCached(pSSG, pCache, dRight - iWidth * dSamplesPerPixel, dRight, 150.0f, -150.0f, pCached, iWidth, iHeight);
+    SSG_RenderCache *pFreshCache = SSG_RenderCacheNew();
+    if (pFreshCache == NULL) goto DONE;
+    SSG_RenderCached(pSSG, pFreshCache, dRight - iWidth * dSamplesPerPixel, dRight, 150.0f, -150.0f, pFresh, iWidth, iHeight);
+    SSG_RenderCacheTeardown(pFreshCache);
+    iMismatches += memcmp(pCached, pFresh, (size_t)iWidth * iHeight) != 0;
+  }
+  iRet = iMismatches == 0 ? 0 : -1;
+  printf("{\"check\":\"render_cached\",\"frames\":%d,\"mismatches\":%d,\"ok\":%s}\n", iFrames, iMismatches, iRet == 0 ? "true" : "false");
+
+DONE:
+  if (pSSG != NULL) SSG_Teardown(pSSG);
+  if (pCache != NULL) SSG_RenderCacheTeardown(pCache);
+  removeGraph("check_cached");
+  free(pfValues);
+  free(pCached);
+  free(pFresh);
+  return iRet;
+}
+
+// A multi-channel graph must render like its channels as single graphs: overlaid as their brightest pixel,
+// stacked as their renders at lane height
+static int checkRenderChannels(void) {
+  static const char *apcNames[] = { "check_channels", "check_channel0", "check_channel1", "check_channel2" };
+  int iChannels = 3, iFrames = RENDER_SAMPLES / 4, iMismatches = 0, i, c, j;
+  float *pfFrames = malloc((size_t)iFrames * iChannels * sizeof(float));
+  float *pfChannel = malloc((size_t)iFrames * sizeof(float));
+  uint8_t *pOut = malloc(VIEW_MAX_WIDTH * VIEW_MAX_HEIGHT);
+  uint8_t *pExpected = malloc(VIEW_MAX_WIDTH * VIEW_MAX_HEIGHT);
+  uint8_t *pChannel = malloc(VIEW_MAX_WIDTH * VIEW_MAX_HEIGHT);
+  SSG *apSSG[4] = { NULL, NULL, NULL, NULL };
+  SSG_Options options = { 0 };
+  int iRet = -1;
+
+  if (pfFrames == NULL || pfChannel == NULL || pOut == NULL || pExpected == NULL || pChannel == NULL) goto DONE;
+  fillWalk(pfFrames, (uint64_t)iFrames * iChannels, 5);
+  options.iChannels = iChannels;
+  apSSG[0] = newGraph(apcNames[0], &options, pfFrames, iFrames);
+  if (apSSG[0] == NULL) goto DONE;
+  for (c = 0; c < iChannels; c++) {
+    for (i = 0; i < iFrames; i++) pfChannel[i] = pfFrames[(size_t)i * iChannels + c];
+    apSSG[c+1] = newGraph(apcNames[c+1], NULL, pfChannel, iFrames);
+    if (apSSG[c+1] == NULL) goto DONE;
+  }
+
+  srand(6);
+  for (i = 0; i < RENDER_VIEWS; i++) {
+    View view, lane;
+    int bMismatch = 0;
+    randomView(&view, -4.0, 18.0, 0.0, iFrames * 1.25);
+    size_t iPixels = (size_t)view.iWidth * view.iHeight;
+
+    memset(pExpected, 0, iPixels);
+    for (c = 0; c < iChannels; c++) {
+      render(apSSG[c+1], &view, pChannel);
+      for (j = 0; j < (int)iPixels; j++) pExpected[j] = MAX(pExpected[j], pChannel[j]);
+    }
+    render(apSSG[0], &view, pOut);
+    bMismatch |= memcmp(pExpected, pOut, iPixels) != 0;
+
+    lane = view;
+    lane.iHeight = view.iHeight / iChannels;
+    if (lane.iHeight >= 1) {
+      memset(pExpected, 0, iPixels);
+      for (c = 0; c < iChannels; c++) render(apSSG[c+1], &lane, pExpected + (size_t)c * lane.iHeight * view.iWidth);
+      SSG_RenderChannels(apSSG[0], view.dLeft, view.dRight, view.fTop, view.fBottom, SSG_LAYOUT_STACKED, pOut, view.iWidth, view.iHeight);
+      bMismatch |= memcmp(pExpected, pOut, iPixels) != 0;
+    }
+    iMismatches += bMismatch;
+  }
+  iRet = iMismatches == 0 ? 0 : -1;
+  printf("{\"check\":\"render_channels\",\"channels\":%d,\"views\":%d,\"mismatches\":%d,\"ok\":%s}\n",
+         iChannels, RENDER_VIEWS, iMismatches, iRet == 0 ? "true" : "false");
+
+DONE:
+  for (c = 0; c <= iChannels; c++) {
+    if (apSSG[c] != NULL) SSG_Teardown(apSSG[c]);
+    removeGraph(apcNames[c]);
+  }
+  free(pfFrames);
+  free(pfChannel);
+  free(pOut);
+  free(pExpected);
+  free(pChannel);
+  return iRet;
+}
+
+// Fan-out 4, 8 and 16 must render like fan-out 2 except at the tail, where the coarser levels end sooner, and
+// query the same everywhere
+static int checkFanout(void) {
+  static const int aiFanouts[] = { 2, 4, 8, 16 };
+  static const char *apcNames[] = { "check_fanout2", "check_fanout4", "check_fanout8", "check_fanout16" };
+  float *pfValues = malloc(RENDER_SAMPLES * sizeof(float));
+  uint8_t *pBufferA = malloc(VIEW_MAX_WIDTH * VIEW_MAX_HEIGHT);
+  uint8_t *pBufferB = malloc(VIEW_MAX_WIDTH * VIEW_MAX_HEIGHT);
+  SSG *apSSG[4] = { NULL, NULL, NULL, NULL };
+  int aiMismatches[4] = { 0, 0, 0, 0 };
+  double dMaxLog2 = 14.0;
+  int i, iRet = -1;
+
+  if (pfValues == NULL || pBufferA == NULL || pBufferB == NULL) goto DONE;
+  fillWalk(pfValues, RENDER_SAMPLES, 7);
+  for (i = 0; i < 4; i++) {
+    SSG_Options options = { 0 };
+    options.iFanout = aiFanouts[i];
+    apSSG[i] = newGraph(apcNames[i], &options, pfValues, RENDER_SAMPLES);
+    if (apSSG[i] == NULL) goto DONE;
+  }
+  // Right edges stay 128 pixels' worth of samples before the end, the LODs between the stored levels of fan-out 16
+  // are made from entries that stop short of it
+  srand(8);
+  for (i = 1; i < 4; i++) {
+    aiMismatches[i] = compareGraphs(apSSG[0], apSSG[i], RENDER_VIEWS, dMaxLog2, -1e5, RENDER_SAMPLES - 128.0 * pow(2.0, dMaxLog2) - 1000.0,
+                                    -1, pBufferA, pBufferB);
+  }
+  iRet = (aiMismatches[1] == 0 && aiMismatches[2] == 0 && aiMismatches[3] == 0) ? 0 : -1;
+  printf("{\"check\":\"fanout\",\"samples\":%d,\"views\":%d,\"mismatches_4\":%d,\"mismatches_8\":%d,\"mismatches_16\":%d,\"ok\":%s}\n",
+         RENDER_SAMPLES, RENDER_VIEWS, aiMismatches[1], aiMismatches[2], aiMismatches[3], iRet == 0 ? "true" : "false");
+
+DONE:
+  for (i = 0; i < 4; i++) {
+    if (apSSG[i] != NULL) SSG_Teardown(apSSG[i]);
+    removeGraph(apcNames[i]);
+  }
+  free(pfValues);
+  free(pBufferA);
+  free(pBufferB);
+  return iRet;
+}
+
+// Edited graphs must render, render density and query like graphs built from the edited samples, also after a
+// reopen
+static int checkSetValues(void) {
+  static const struct {
+    int iFanout, iChannels, iSampleType, bDensity;
+  } aConfigs[] = { { 2, 1, SSG_SAMPLE_FLOAT, 0 }, { 8, 3, SSG_SAMPLE_INT16, 1 }, { 16, 1, SSG_SAMPLE_FLOAT, 1 } };
+  int iConfigs = (int)(sizeof(aConfigs) / sizeof(aConfigs[0])), iMismatches = 0, iFailedEdits = 0, iConfig, i;
+  float *pfFrames = malloc((size_t)EDIT_SAMPLES * 3 * sizeof(float));
+  float *pfEdit = malloc((size_t)EDIT_SAMPLES * 3 * sizeof(float));
+  uint8_t *pBufferA = malloc(VIEW_MAX_WIDTH * VIEW_MAX_HEIGHT);
+  uint8_t *pBufferB = malloc(VIEW_MAX_WIDTH * VIEW_MAX_HEIGHT);
+  SSG *pEdited = NULL, *pFresh = NULL;
+  int iRet = -1;
+
+  if (pfFrames == NULL || pfEdit == NULL || pBufferA == NULL || pBufferB == NULL) goto DONE;
+  for (iConfig = 0; iConfig < iConfigs; iConfig++) {
+    SSG_Options options = { 0 };
+    int iChannels = aConfigs[iConfig].iChannels, iDensityMaxDiff = aConfigs[iConfig].bDensity ? EDIT_DENSITY_MAX_DIFF : -1;
+    options.iFanout = aConfigs[iConfig].iFanout;
+    options.iChannels = iChannels;
+    options.iSampleType = aConfigs[iConfig].iSampleType;
+    options.dScale = options.iSampleType == SSG_SAMPLE_INT16 ? 0.01 : 0.0;
+    options.bDensity = aConfigs[iConfig].bDensity;
+
+    fillWalk(pfFrames, (uint64_t)EDIT_SAMPLES * iChannels, 9 + iConfig);
+    pEdited = newGraph("check_edited", &options, pfFrames, EDIT_SAMPLES);
+    if (pEdited == NULL) goto DONE;
+    srand(12 + iConfig);
+    for (i = 0; i < EDITS; i++) {
+      uint64_t iStart = (uint64_t)(rand() / ((double)RAND_MAX + 1.0) * EDIT_SAMPLES);
+      uint64_t iCount = (i % 3 == 0) ? 1 : 1 + rand() % ((i % 5 == 0) ? EDIT_SAMPLES / 3 : 300);
+      uint64_t j;
+      int iEditRet;
+      iCount = MIN(iCount, EDIT_SAMPLES - iStart);
+      for (j = 0; j < iCount * iChannels; j++) pfEdit[j] = (rand() % 2000 - 1000) * 0.05f;
+      if (iChannels == 1 && iCount == 1) {
+        iEditRet = SSG_SetValue(pEdited, iStart, pfEdit[0]);
+      } else if (iChannels == 1) {
+        iEditRet = SSG_SetValues(pEdited, iStart, pfEdit, iCount);
+      } else {
+        iEditRet = SSG_SetFrames(pEdited, iStart, pfEdit, iCount);
+      }
+      iFailedEdits += iEditRet != 0;
+      memcpy(pfFrames + iStart * iChannels, pfEdit, iCount * iChannels * sizeof(float));
+    }
+    // Edits past the end are refused
+    iFailedEdits += SSG_SetFrames(pEdited, EDIT_SAMPLES - 1, pfEdit, 2) == 0;
+
+    pFresh = newGraph("check_unedited", &options, pfFrames, EDIT_SAMPLES);
+    if (pFresh == NULL) goto DONE;
+    iMismatches += compareGraphs(pEdited, pFresh, RENDER_VIEWS / 4, 18.0, 0.0, EDIT_SAMPLES * 1.25, iDensityMaxDiff, pBufferA, pBufferB);
+    SSG_Teardown(pEdited);
+    pEdited = SSG_New("check_edited", 0);
+    if (pEdited == NULL) goto DONE;
+    iMismatches += compareGraphs(pEdited, pFresh, RENDER_VIEWS / 4, 18.0, 0.0, EDIT_SAMPLES * 1.25, iDensityMaxDiff, pBufferA, pBufferB);
+    SSG_Teardown(pEdited);
+    SSG_Teardown(pFresh);
+    pEdited = pFresh = NULL;
+  }
+  iRet = (iMismatches == 0 && iFailedEdits == 0) ? 0 : -1;
+  printf("{\"check\":\"set_values\",\"configs\":%d,\"edits\":%d,\"failed_edits\":%d,\"mismatches\":%d,\"ok\":%s}\n",
+         iConfigs, EDITS, iFailedEdits, iMismatches, iRet == 0 ? "true" : "false");
+
+DONE:
+  if (pEdited != NULL) SSG_Teardown(pEdited);
+  if (pFresh != NULL) SSG_Teardown(pFresh);
+  removeGraph("check_edited");
+  removeGraph("check_unedited");
+  free(pfFrames);
+  free(pfEdit);
+  free(pBufferA);
+  free(pBufferB);
+  return iRet;
+}
+
+// Min and max of every channel over [iStart, iEnd) of hashSample, clamped to the kept samples
+static void bruteForceRange(uint64_t iStart, uint64_t iEnd, int iChannels, float *pfMin, float *pfMax) {
+  uint64_t i;
+  int c;
+  for (c = 0; c < iChannels; c++) {
+    pfMin[c] = INFINITY;
+    pfMax[c] = -INFINITY;
+    for (i = iStart; i < iEnd; i++) {
+      pfMin[c] = MIN(pfMin[c], hashSample(i, c));
+      pfMax[c] = MAX(pfMax[c], hashSample(i, c));
+    }
+  }
+}
+
+// With retention, SSG_QueryRange must match brute force over the kept samples as the ring wraps, and renders of
+// the kept range must match a graph without retention
+static int checkRetentionQuery(void) {
+  static const int aiFanouts[] = { 2, 16 }, aiChannels[] = { 1, 3 };
+  float afMin[SSG_MAX_CHANNELS], afMax[SSG_MAX_CHANNELS], afExpectedMin[SSG_MAX_CHANNELS], afExpectedMax[SSG_MAX_CHANNELS];
+  float *pfFrames = malloc(70000 * 3 * sizeof(float));
+  uint8_t *pBufferA = malloc(VIEW_MAX_WIDTH * VIEW_MAX_HEIGHT);
+  uint8_t *pBufferB = malloc(VIEW_MAX_WIDTH * VIEW_MAX_HEIGHT);
+  SSG *pRetained = NULL, *pAll = NULL;
+  int iQueryMismatches = 0, iRenderMismatches = 0, iLengthMismatches = 0, iConfig, iRound, i, c;
+  int iRet = -1;
+
+  if (pfFrames == NULL || pBufferA == NULL || pBufferB == NULL) goto DONE;
+  srand(15);
+  for (iConfig = 0; iConfig < 2; iConfig++) {
+    SSG_Options options = { 0 };
+    int iChannels = aiChannels[iConfig];
+    uint64_t iLength = 0;
+    options.iFanout = aiFanouts[iConfig];
+    options.iChannels = iChannels;
+    options.iRetainSamples = RETAIN_SAMPLES;
+    pRetained = newGraph("check_retained", &options, NULL, 0);
+    options.iRetainSamples = 0;
+    pAll = newGraph("check_all", &options, NULL, 0);
+    if (pRetained == NULL || pAll == NULL) goto DONE;
+
+    for (iRound = 0; iRound < RETAIN_ROUNDS; iRound++) {
+      int iCount = (iRound % 3 == 0) ? 1 + rand() % 3000 : 1 + rand() % 70000;
+      for (i = 0; i < iCount; i++) {
+        for (c = 0; c < iChannels; c++) pfFrames[i*iChannels + c] = hashSample(iLength + i, c);
+      }
+      SSG_AddFrames(pRetained, pfFrames, iCount);
+      SSG_AddFrames(pAll, pfFrames, iCount);
+      iLength += iCount;
+      uint64_t iFirst = SSG_GetFirstSample(pRetained);
+      iLengthMismatches += SSG_GetLength(pRetained) != iLength || iFirst != (iLength > RETAIN_SAMPLES ? iLength - RETAIN_SAMPLES : 0);
+
+      for (i = 0; i < 20; i++) {
+        // Every fifth range starts around the oldest kept sample, before it or after
+        uint64_t iStart = iFirst + (uint64_t)(rand() / ((double)RAND_MAX + 1.0) * (iLength - iFirst));
+        if (i % 5 == 0) {
+          iStart = iFirst > 1000 ? iFirst - 1000 + rand() % 2000 : (uint64_t)(rand() % 1000);
+          iStart = MIN(iStart, iLength - 1);
+        }
+        uint64_t iEnd = iStart + 1 + (uint64_t)(rand() / ((double)RAND_MAX + 1.0) * (iLength - iStart));
+        int iQueryRet = SSG_QueryRange(pRetained, iStart, iEnd, afMin, afMax);
+        if (iEnd <= iFirst) {
+          iQueryMismatches += iQueryRet != -1;
+          continue;
+        }
+        bruteForceRange(MAX(iStart, iFirst), iEnd, iChannels, afExpectedMin, afExpectedMax);
+        iQueryMismatches += iQueryRet != 0 || memcmp(afMin, afExpectedMin, iChannels * sizeof(float)) != 0 ||
+                            memcmp(afMax, afExpectedMax, iChannels * sizeof(float)) != 0;
+      }
+      // Views from a margin after the oldest kept sample, where the coarsest levels read may still hold older data
+      for (i = 0; i < 10; i++) {
+        View view;
+        randomView(&view, -2.0, 10.0, 0.0, 1.0);
+        double dSpan = view.dRight - view.dLeft, dLow = iFirst + 40.0 * dSpan / view.iWidth + 64.0;
+        if (dLow + dSpan + 1.0 > iLength) continue;
+        view.dLeft = dLow + (iLength - dLow - dSpan) * (rand() / (double)RAND_MAX);
+        view.dRight = view.dLeft + dSpan;
+        view.fTop = 11000.0f;
+        view.fBottom = -11000.0f;
+        render(pRetained, &view, pBufferA);
+        render(pAll, &view, pBufferB);
+        iRenderMismatches += memcmp(pBufferA, pBufferB, (size_t)view.iWidth * view.iHeight) != 0;
+      }
+    }
+    SSG_Teardown(pRetained);
+    SSG_Teardown(pAll);
+    pRetained = pAll = NULL;
+  }
+  iRet = (iQueryMismatches == 0 && iRenderMismatches == 0 && iLengthMismatches == 0) ? 0 : -1;
+  printf("{\"check\":\"retention_query\",\"retain\":%d,\"rounds\":%d,\"length_mismatches\":%d,\"query_mismatches\":%d,"
+         "\"render_mismatches\":%d,\"ok\":%s}\n", RETAIN_SAMPLES, RETAIN_ROUNDS, iLengthMismatches, iQueryMismatches,
+         iRenderMismatches, iRet == 0 ? "true" : "false");
+
+DONE:
+  if (pRetained != NULL) SSG_Teardown(pRetained);
+  if (pAll != NULL) SSG_Teardown(pAll);
+  removeGraph("check_retained");
+  removeGraph("check_all");
+  free(pfFrames);
+  free(pBufferA);
+  free(pBufferB);
+  return iRet;
+}
+
+// A process that dies after SSG_Flush and more appends must leave a graph that reopens at the committed length,
+// renders and queries like a graph of just the committed samples, and takes further appends like one that never
+// crashed
+static int checkReopenFlush(void) {
+  uint64_t iTotal = REOPEN_COMMITTED + REOPEN_LOST;
+  float *pfValues = malloc(iTotal * sizeof(float));
+  uint8_t *pBufferA = malloc(VIEW_MAX_WIDTH * VIEW_MAX_HEIGHT);
+  uint8_t *pBufferB = malloc(VIEW_MAX_WIDTH * VIEW_MAX_HEIGHT);
+  SSG *pReopened = NULL, *pFresh = NULL;
+  uint64_t iCommittedLength = 0, iResumedLength = 0;
+  int iMismatches = 0, iStatus = 0;
+  int iRet = -1;
+
+  if (pfValues == NULL || pBufferA == NULL || pBufferB == NULL) goto DONE;
+  fillWalk(pfValues, iTotal, 16);
+  removeGraph("check_reopen");
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid < 0) goto DONE;
+  if (pid == 0) {
+    // Exit without a teardown, which would commit the rest
+    SSG *pSSG = SSG_New("check_reopen", 1);
+    if (pSSG == NULL) _exit(1);
+    SSG_AddValues(pSSG, pfValues, REOPEN_COMMITTED);
+    if (SSG_Flush(pSSG, 1) != 0) _exit(1);
+    SSG_AddValues(pSSG, pfValues + REOPEN_COMMITTED, REOPEN_LOST);
+    _exit(0);
+  }
+  if (waitpid(pid, &iStatus, 0) != pid || !WIFEXITED(iStatus) || WEXITSTATUS(iStatus) != 0) goto DONE;
+
+  pReopened = SSG_New("check_reopen", 0);
+  pFresh = newGraph("check_uncrashed", NULL, pfValues, REOPEN_COMMITTED);
+  if (pReopened == NULL || pFresh == NULL) goto DONE;
+  iCommittedLength = SSG_GetLength(pReopened);
+  srand(17);
+  iMismatches += compareGraphs(pReopened, pFresh, RENDER_VIEWS / 2, 18.0, 0.0, REOPEN_COMMITTED * 1.25, -1, pBufferA, pBufferB);
+  SSG_Teardown(pReopened);
+
+  // Resume where the commit left off
+  pReopened = SSG_New("check_reopen", 1);
+  if (pReopened == NULL) goto DONE;
+  SSG_AddValues(pReopened, pfValues + REOPEN_COMMITTED, REOPEN_LOST);
+  SSG_AddValues(pFresh, pfValues + REOPEN_COMMITTED, REOPEN_LOST);
+  iResumedLength = SSG_GetLength(pReopened);
+  iMismatches += compareGraphs(pReopened, pFresh, RENDER_VIEWS / 2, 18.0, 0.0, iTotal * 1.25, -1, pBufferA, pBufferB);
+
+  iRet = (iCommittedLength == REOPEN_COMMITTED && iResumedLength == iTotal && iMismatches == 0) ? 0 : -1;
+  printf("{\"check\":\"reopen_flush\",\"committed\":%d,\"lost\":%d,\"reopened_length\":%llu,\"resumed_length\":%llu,"
+         "\"mismatches\":%d,\"ok\":%s}\n", REOPEN_COMMITTED, REOPEN_LOST, (unsigned long long)iCommittedLength,
+         (unsigned long long)iResumedLength, iMismatches, iRet == 0 ? "true" : "false");
+
+DONE:
+  if (pReopened != NULL) SSG_Teardown(pReopened);
+  if (pFresh != NULL) SSG_Teardown(pFresh);
+  removeGraph("check_reopen");
+  removeGraph("check_uncrashed");
+  free(pfValues);
+  free(pBufferA);
+  free(pBufferB);
+  return iRet;
+}
+
+static const struct {
+  const char *pcName;
+  int (*pfnCheck)(void);
+} aChecks[] = {
+  { "render_reference", checkRenderReference },
+  { "render_cached", checkRenderCached },
+  { "render_channels", checkRenderChannels },
+  { "fanout", checkFanout },
+  { "set_values", checkSetValues },
+  { "retention_query", checkRetentionQuery },
+  { "reopen_flush", checkReopenFlush },
+  { "density_offset", checkDensityOffset },
+};
+
+int main(int argc, char* argv[]) {
+  int iChecks = (int)(sizeof(aChecks) / sizeof(aChecks[0]));
+  int i, j, iFailed = 0;
+
+  for (i = 0; i < iChecks; i++) {
+    int bRun = argc < 2;
+    for (j = 1; j < argc; j++) bRun |= strcmp(argv[j], aChecks[i].pcName) == 0;
+    if (!bRun) continue;
+    fprintf(stderr, "%s...\n", aChecks[i].pcName);
+    if (aChecks[i].pfnCheck() != 0) {
+      fprintf(stderr, "%s failed\n", aChecks[i].pcName);
+      iFailed++;
+    }
+  }
+  for (j = 1; j < argc; j++) {
+    for (i = 0; i < iChecks && strcmp(argv[j], aChecks[i].pcName) != 0; i++);
+    if (i == iChecks) {
+      fprintf(stderr, "Unknown check %s\n", argv[j]);
+      iFailed++;
+    }
+  }
+  return iFailed != 0;
+}
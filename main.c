@@ -20,11 +20,15 @@ SSG* pSSG;
 float fBrownianWalk = 0.0f;
 uint64_t iSamplesAdded = 0;
 
-void addRandomSample() {
+float nextRandomSample() {
   fBrownianWalk += ((rand() & 8191)-4096) * 0.002f;
   fBrownianWalk *= (0.6+0.4*cos(iSamplesAdded*0.0003));
-  SSG_AddValue(pSSG, fBrownianWalk);
   iSamplesAdded++;
+  return fBrownianWalk;
+}
+
+void addRandomSample() {
+  SSG_AddValue(pSSG, nextRandomSample());
 }
 
 int main(int argc, char* argv[]) {
@@ -33,14 +37,21 @@ int main(int argc, char* argv[]) {
   char title[255];
 
   pSSG = SSG_New("test", 1);
+  if (pSSG == NULL) {
+    printf("Could not open test.ssg, it is not a graph or the directory is not writable\n");
+    ret = -1;
+    goto ERRET;
+  }
 
   iSamplesAdded = SSG_GetLength(pSSG);
 
   printf("getlength returned %ld\n", iSamplesAdded);
   if (iSamplesAdded==0) {
     printf("First time running. Generate a big chunk of randomness...\n");
-    for (i = 0; i < 100000000; i++) {
-      addRandomSample();
+    float afBlock[4000];
+    for (i = 0; i < 100000000; i += 4000) {
+      for (j = 0; j < 4000; j++) afBlock[j] = nextRandomSample();
+      SSG_AddValues(pSSG, afBlock, 4000);
     }
   }
   unsigned int graph_width = 2048; //192;
@@ -48,6 +59,7 @@ int main(int argc, char* argv[]) {
   double dSamplesPerPixel = 200000.0 / (double)graph_width;
   float fValueAtTopmostPixel = 300.0f;
   float fValueAtBottommostPixel = -fValueAtTopmostPixel;
+  SSG_AutoRange(pSSG, iSamplesAdded - graph_width*dSamplesPerPixel, iSamplesAdded, &fValueAtTopmostPixel, &fValueAtBottommostPixel);
   float fValuesPerPixel = (fValueAtBottommostPixel - fValueAtTopmostPixel) / (float)graph_height;
 
 
@@ -100,6 +112,7 @@ int main(int argc, char* argv[]) {
   SDL_GetWindowPosition(window, &x, &y);
 
   uint8_t* pGraphBuf = calloc(graph_width*graph_height, 1);
+  SSG_RenderCache* pRenderCache = SSG_RenderCacheNew();
   uint32_t *framebuffer = calloc(window_width*window_height*4, 1);
   for (i=0; i<window_width*window_height; i++) framebuffer[i] = 0xff000080;
 
@@ -132,7 +145,7 @@ int main(int argc, char* argv[]) {
       //dSamplesPerPixel = (double)iSamplesAdded / (double)graph_width;
 
       // Render graph to 8-bit buffer
-      SSG_Render(pSSG, dSamplePosAtRightmostPixel-graph_width*dSamplesPerPixel, dSamplePosAtRightmostPixel, fValueAtBottommostPixel-graph_height*fValuesPerPixel, fValueAtBottommostPixel, pGraphBuf, graph_width, graph_height);
+      SSG_RenderCached(pSSG, pRenderCache, dSamplePosAtRightmostPixel-graph_width*dSamplesPerPixel, dSamplePosAtRightmostPixel, fValueAtBottommostPixel-graph_height*fValuesPerPixel, fValueAtBottommostPixel, pGraphBuf, graph_width, graph_height);
 
       // point sample upscale to window size (to make visible pixels) and make it ARGB.
       for (x=0; x<window_width; x++) {
@@ -162,6 +175,14 @@ int main(int argc, char* argv[]) {
           if (event.key.keysym.scancode == SDL_SCANCODE_ESCAPE) running = 0;
           if (event.key.keysym.scancode == SDL_SCANCODE_SPACE) {pause=1-pause;}
           if (event.key.keysym.scancode == SDL_SCANCODE_A) {autofollow=1-autofollow;}
+          if (event.key.keysym.scancode == SDL_SCANCODE_F) {
+            // Fit the value axis to the visible samples
+            float fTop, fBottom;
+            if (SSG_AutoRange(pSSG, dSamplePosAtRightmostPixel-graph_width*dSamplesPerPixel, dSamplePosAtRightmostPixel, &fTop, &fBottom) == 0) {
+              fValuesPerPixel = (fBottom - fTop) / (float)graph_height;
+              fValueAtBottommostPixel = fBottom;
+            }
+          }
           break;
         case SDL_MOUSEWHEEL:
         {
@@ -224,6 +245,7 @@ int main(int argc, char* argv[]) {
     usleep(1000);
   }
 
+  SSG_RenderCacheTeardown(pRenderCache);
   SSG_Teardown(pSSG);
 
   return 0;
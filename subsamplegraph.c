@@ -22,6 +22,9 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // RUSAGE_THREAD
+#endif
 #include <stdlib.h>
 #include <math.h>
 #include <stdio.h>
@@ -31,279 +34,3732 @@ SOFTWARE.
 #include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/resource.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+
+// Build with NO_SIMD to use only the portable scalar column rasterizer
+#if !defined(NO_SIMD) && defined(__SSE2__)
+#include <emmintrin.h>
+#define HAVE_SSE2_RASTERIZER
+#endif
+#if !defined(NO_SIMD) && defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define HAVE_AVX2_RASTERIZER
+#endif
 
 #include "subsamplegraph.h"
 
-#define BLOCK_SIZE (2*1024*1024/sizeof(float))
+#define REBUILD_MAX_THREADS 64
+#define RENDER_BAND_WIDTH 64 // Columns per task in tiled rendering, a band's tile stays in L2
+#define TRANSPOSE_BLOCK 16
+#define INGEST_CHUNK (64*1024) // Samples reduced per pass in SSG_AddValues, keeps a chunk's levels in cache
 
-typedef struct {
-  int fd;                 // file mapped to memory block
-  int bWritable;          // is memory mapped as writable and resizable?
-  float *pfBuffer;        // memory mapped file as floats
-  uint64_t iAllocated;    // number of floats allocated
-  uint64_t iWritePointer; // index of next element to write
-#ifdef DEBUGPRINTS
-  char *pFilenamecopy;
+#define MAX_MIP_LOD 62 // coarsest LOD, an entry covers 2^62 raw samples, more than any 64-bit length needs
+
+#define MIN(a,b) (((a)<(b))?(a):(b))
+#define MAX(a,b) (((a)>(b))?(a):(b))
+
+/*
+ * Container file
+ *
+ * All data of a graph lives in one file, <base>.ssg: a one page header with a level directory, followed by extents.
+ * Level 0 holds the raw samples, level L holds interleaved min/max pairs that each cover 2^L raw samples, so one
+ * render lookup reads one cache line. The directory has room for levels up to 2^MAX_MIP_LOD raw samples per entry,
+ * and a level only gets extents once the samples reach it, so the pyramid grows with the data. A level grows by
+ * appending an extent at the end of the file. Extent e of a level holds EXTENT_BASE<<e entries, which makes finding
+ * an entry a bit scan. The file offsets of the extents are in an extent table the level gets with its first extent.
+ * Tables are handed out from the rest of the header page, then from blocks of EXTENT_TABLE_BLOCK bytes at the file
+ * end, so a small graph only pays for the levels it has. The file is mapped in windows of growing size that stay in
+ * place until teardown, and a writer maps them well ahead of the file end. The file itself is allocated
+ * ahead in growing steps. Nothing is synced while growing, see SSG_Flush.
+ */
+
+#define CONTAINER_MAGIC "SSGRAPH"
+#define CONTAINER_VERSION 1
+#define CONTAINER_LEVELS (MAX_MIP_LOD+1)
+#if SSG_STATS_LEVELS < CONTAINER_LEVELS
+#error SSG_STATS_LEVELS must cover all container levels
 #endif
+#define MAX_EXTENTS 48
+#define EXTENT_BASE_LOG2 10
+#define EXTENT_TABLE_SIZE (MAX_EXTENTS * sizeof(uint64_t)) // file offset of each extent of a level
+#define EXTENT_TABLE_BLOCK 4096                            // bytes of extent tables added to the file at a time
+#define MAX_WINDOWS 64
+#define MIN_WINDOW_SIZE (64*1024*1024) // address space only, mapped ahead of the file end
+#define MIN_FILE_GROWTH (8*1024*1024) // from this size on, smaller files double
+#define MAX_FILE_GROWTH (1024*1024*1024)
+#define COLD_BLOCK_LOG2 EXTENT_BASE_LOG2 // raw frames per compressed block, so a block never straddles two extents
+#define COLD_GROUP 32                     // residuals bit packed with one width
+#define COLD_BATCH 64                     // blocks compressed between syncs
+#define COLD_CACHE_BLOCKS 8               // decompressed blocks kept for reading
+#define COLD_POLL_MS 100                  // cold storage thread idle wait
+#define FLUSH_POLL_MS 1000                // flusher wait without an interval, in case a request was missed
+#define TIME_BLOCK_LOG2 EXTENT_BASE_LOG2  // frames per entry of the timestamp index, a block is never split
+#define PREFETCH_MARGIN 4                 // entries read around a view for interpolation, per level
+#define DENSITY_BLOCK_LOG2 5              // fewest raw frames per moment entry, rounded up to a stored level
+#define DENSITY_ENTRIES 8                 // fewest entries a density column is made of, finer views read raw frames
+#define DENSITY_RAW_CHUNK 256             // raw frames read at a time for a density column
+#define READ_ATTEMPTS 4                   // reads overlapping an edit before a reading call holds edits off
+
+typedef struct {
+  uint64_t iLength;                     // committed number of entries
+  uint64_t iExtents;                    // number of allocated extents
+  uint64_t iExtentTable;                // file offset of the extent table, 0 before the first extent
+} ContainerLevel;
+
+typedef struct {
+  char acMagic[8];
+  uint32_t iVersion;
+  uint32_t iHeaderSize;                 // bytes before the first extent
+  uint32_t iLevels;
+  uint32_t iExtentBaseLog2;
+  ContainerLevel aLevels[CONTAINER_LEVELS];
+  uint32_t iFanoutLog2;                 // each level entry covers 2^iFanoutLog2 entries of the level below
+  uint32_t iChannels;                   // values per frame
+  uint32_t iSampleType;                 // SSG_SAMPLE_*, of raw samples and LOD levels alike
+  uint32_t iFlags;                      // CONTAINER_FLAG_*
+  double dScale;                        // physical value = stored value * dScale + dOffset
+  double dOffset;
+  uint64_t iDataEnd;                    // end of the last extent, the file may be longer
+  uint64_t iColdBlocks;                 // leading blocks of raw samples stored compressed, see Cold storage
+  ContainerLevel coldIndex;             // per cold block, offset of its compressed data in coldData
+  ContainerLevel coldData;              // compressed blocks, a byte per entry
+  ContainerLevel times;                 // per raw frame, its int64 timestamp, see Timestamps
+  ContainerLevel timeIndex;             // per block of 2^TIME_BLOCK_LOG2 frames, its first timestamp
+  uint64_t iRetainSamples;              // 0 for all, else raw samples kept, older ones are overwritten, see Retention
+  ContainerLevel aMomentLevels[CONTAINER_LEVELS]; // per entry of a stored level, the mean and M2 of its raw values,
+                                                  // see Density. Only with CONTAINER_FLAG_MOMENT_LEVELS.
+  uint64_t iTableNext;                  // file offset of the next free extent table
+  uint64_t iTableEnd;                   // end of the block it is in
+} ContainerHeader;
+
+#define CONTAINER_FLAG_TIMESTAMPS    1
+#define CONTAINER_FLAG_MOMENT_LEVELS 2
+
+#define CONTAINER_HEADER_SIZE 4096
+_Static_assert(sizeof(ContainerHeader) + EXTENT_TABLE_SIZE <= CONTAINER_HEADER_SIZE, "the header page must hold an extent table");
+
+typedef struct {
+  uint8_t *apExtent[MAX_EXTENTS]; // mapped extents
+  uint64_t *piExtentOffset;       // mapped extent table, NULL before the first extent
+  int iExtents;
+  int iValues;            // values per channel, 1 for raw samples, 2 for min/max pairs
+  int iStride;            // values per entry, iValues for each channel
+  int iEntrySize;         // bytes per entry
+  uint64_t iAllocated;    // number of entries in allocated extents, all of them once a ring is allocated
+  uint64_t iWritePointer; // index of next entry to write
+  uint64_t iRing;         // entries before the index wraps around, 0 for none, see Retention
 } Buffer;
 
-int mapfiletomemblock(char *pFilename, Buffer* pOutMemblock, int bWritable) {
-#ifdef DEBUGPRINTS
-  pOutMemblock->pFilenamecopy = malloc(strlen(pFilename)+1);
-  strcpy(pOutMemblock->pFilenamecopy, pFilename);
-#endif
-  int fd = open(pFilename,O_RDWR | O_APPEND | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+typedef struct {
+  uint8_t *pBase;
+  uint64_t iOffset; // file offset at pBase
+  uint64_t iSize;
+} Window;
 
-  uint64_t iUsed = lseek(fd, 0, SEEK_END) / sizeof(float); // Number of elements in file
+// Statistics, see SSG_GetStats. Times in nanoseconds.
+typedef struct {
+  uint64_t iMaps, iMapNs;
+  uint64_t iFileGrowths, iFileGrowthNs;
+  uint64_t iSyncs, iSyncNs;
+  uint64_t iRenders, iRenderNs, iMaxRenderNs;
+  uint64_t iColumnsRendered;
+  uint64_t iLastLod;
+  uint64_t aiRendersPerLod[SSG_STATS_LEVELS];
+  uint64_t iRenderMinorFaults, iRenderMajorFaults;
+  uint64_t iColdCacheMisses;
+} Counters;
 
-  uint64_t iAllocated = iUsed;
-  if (bWritable) {
-    iAllocated = (iUsed + BLOCK_SIZE - 1) & (~(BLOCK_SIZE-1));
-    if (iAllocated==0) iAllocated = BLOCK_SIZE; // If all new file, give it some initial space
+typedef struct {
+  int64_t iBlock;   // cold block held, -1 for none
+  uint64_t iUsed;   // last use, for replacement
+  uint8_t *pFrames; // decompressed raw frames
+} ColdCacheEntry;
 
-    ftruncate(fd, iAllocated*sizeof(float));
-  }
+struct SSG_private {
+  Buffer samples;
+  Buffer *pLodBuffers;         // levels 1 to iLevels
+  uint8_t aiGammaxlat[256];
+  int bWritable;
+  int iFanoutLog2;             // each level entry covers 2^iFanoutLog2 entries of the level below
+  int iLevels;                 // number of LOD levels above the raw samples, levels without entries cost nothing
+  int iChannels;               // values per frame, channels are interleaved in every level
+  int iSampleType;             // SSG_SAMPLE_* of all stored values
+  double dScale;               // physical value = stored value * dScale + dOffset
+  double dOffset;
+  float fScale;                // the same for rendering
+  float fOffset;
+  int bPassThrough;            // float samples without scaling, added values are stored as they are
+  void *pEncodeBuffer;         // added values converted to the sample type, INGEST_CHUNK values
+  uint64_t iPublishedLength;   // raw samples readers may use, every level is complete up to here
+  uint64_t iCommittedLength;   // raw samples a crash can't lose, see Durability
+  SSG_WorkerPool *pWorkerPool; // tiled parallel rendering when set
+  int bStats;                  // collect statistics
+  uint64_t iOpenLength;        // length when opened, for the samples added since
+  Counters stats;
+  int fd;
+  ContainerHeader *pHeader;    // mapped header and level directory
+  Window aWindows[MAX_WINDOWS];
+  int iWindows;
+  uint64_t iFileSize;          // end of the last extent
+  uint64_t iFileCapacity;      // allocated file size
+  pthread_mutex_t allocLock;   // file growth and mapping, taken by the writer and the cold storage thread
+  int aiReaders[2];            // readers in each reader epoch, see waitForReaders
+  int iReaderEpoch;
+  Buffer coldIndex;            // cold storage of the raw samples
+  Buffer coldData;
+  uint64_t iColdBlocks;        // published number of cold blocks, raw samples below are read from coldData
+  uint64_t iHotSamples;        // newest raw samples kept uncompressed by the cold storage thread
+  int bColdThread;             // cold storage thread running
+  int bColdStop;
+  pthread_t coldThread;
+  pthread_mutex_t coldLock;    // block cache, and the thread control fields with coldWake
+  pthread_cond_t coldWake;
+  ColdCacheEntry aColdCache[COLD_CACHE_BLOCKS];
+  uint64_t iColdCacheClock;
+  pthread_mutex_t commitLock;  // one commit at a time
+  int bRewritten;              // entries rewritten in place since the last commit, set by the writer, atomic
+  uint64_t iRewrittenBytes;    // raw bytes rewritten since the last commit, for the flush threshold, atomic
+  uint64_t iRewrites;          // twice the edits so far, plus 1 while one is under way, see Concurrent readers
+  int iRewriteHolds;           // reading calls that hold new edits off
+  uint64_t iFlushBytes;        // raw bytes added or rewritten since the last commit that make the writer wake the flusher
+  int bFlushRequested;
+  int iFlushIntervalMs;        // flusher period, 0 for byte threshold only
+  int bFlushThread;            // flusher running
+  int bFlushStop;
+  pthread_t flushThread;
+  pthread_mutex_t flushLock;   // the flusher control fields, with flushWake
+  pthread_cond_t flushWake;
+  int bTimestamps;             // a timestamp per frame in times, else a frame's time is its index
+  Buffer times;
+  Buffer timeIndex;
+  uint64_t iRetainSamples;     // newest raw samples kept, UINT64_MAX for all
+  uint64_t iRingSlack;         // ring entries beyond the kept ones, in raw samples, UINT64_MAX without retention
+  int bPrefetchThread;         // prefetch thread running, renders pass it their views
+  int bPrefetchStop;
+  pthread_t prefetchThread;
+  pthread_mutex_t prefetchLock; // the view to prefetch around and the thread control fields, with prefetchWake
+  pthread_cond_t prefetchWake;
+  int bPrefetchPending;
+  double dPrefetchLeft;        // last rendered view, in raw samples
+  double dPrefetchRight;
+  int iPrefetchLod;
+  int iMomentLog2;             // raw frames per entry of the first level with moments, log2, 0 without moments
+  Buffer *pMomentBuffers;      // moments of the levels from iMomentLog2/iFanoutLog2 to iLevels
+};
+
+static inline int extentOf(uint64_t iIndex) {
+  return 63 - __builtin_clzll((iIndex >> EXTENT_BASE_LOG2) + 1);
+}
+static inline uint64_t extentStart(int iExtent) {
+  return ((1ULL << iExtent) - 1) << EXTENT_BASE_LOG2;
+}
+// Entries from iIndex to the end of its extent
+static inline uint64_t extentRun(uint64_t iIndex) {
+  return extentStart(extentOf(iIndex) + 1) - iIndex;
+}
+static inline void *entryPtr(const Buffer *pB, uint64_t iIndex) {
+  if (pB->iRing != 0) iIndex %= pB->iRing;
+  int iExtent = extentOf(iIndex);
+  return pB->apExtent[iExtent] + (iIndex - extentStart(iExtent)) * pB->iEntrySize;
+}
+// Entries from iIndex that are contiguous in memory, up to the end of its extent or of the ring
+static inline uint64_t bufferRun(const Buffer *pB, uint64_t iIndex) {
+  if (pB->iRing == 0) return extentRun(iIndex);
+  iIndex %= pB->iRing;
+  return MIN(extentRun(iIndex), pB->iRing - iIndex);
+}
+static Buffer *levelBuffer(SSG* pThis, int iLevel) {
+  return (iLevel == 0) ? &pThis->samples : &pThis->pLodBuffers[iLevel-1];
+}
+// Moments of the entries of a level, from level iMomentLog2/iFanoutLog2 up
+static Buffer *momentBuffer(SSG* pThis, int iLevel) {
+  return &pThis->pMomentBuffers[iLevel - pThis->iMomentLog2 / pThis->iFanoutLog2];
+}
 
-  pOutMemblock->pfBuffer = mmap (0, iAllocated*sizeof(float), PROT_READ | (bWritable?PROT_WRITE:0), MAP_SHARED, fd, 0);
-  // TODO: Handle error
-  if (pOutMemblock->pfBuffer == MAP_FAILED) printf("%d: %s\n", errno, strerror(errno));
+/*
+ * Concurrent readers
+ *
+ * One thread adds samples while others render. The writer fills entries and extent pointers first and then
+ * publishes the new length with a release store. Readers take the length once per call with an acquire load and
+ * never look past it, which makes everything below it visible. Mappings are only added, never moved or unmapped
+ * before teardown, so a pointer a reader picked up stays valid. Readers take no locks.
+ *
+ * SSG_SetFrames rewrites published samples, their level entries and moments in place, and SSG_RebuildLods all
+ * level entries and moments, and neither waits for readers. Like a seqlock, iRewrites is odd while an edit is under
+ * way. A reading call notes it before its reads and checks it after them, and reads again if an edit overlapped, so
+ * it returns either all of an edit or none of it. An edit only touches the entries over its range, so it is short,
+ * a rebuild keeps reading calls retrying until it is done. A reading call that overlaps edits READ_ATTEMPTS times in
+ * a row holds new ones off until it gets through, so a stream of edits can't starve it.
+ */
 
-  pOutMemblock->iWritePointer = iUsed;
-  pOutMemblock->iAllocated = iAllocated;
-  pOutMemblock->fd = fd;
-  pOutMemblock->bWritable = bWritable;
+static void publishLength(SSG *pThis) {
+  __atomic_store_n(&pThis->iPublishedLength, pThis->samples.iWritePointer, __ATOMIC_RELEASE);
+}
+static uint64_t publishedLength(SSG *pThis) {
+  return __atomic_load_n(&pThis->iPublishedLength, __ATOMIC_ACQUIRE);
+}
+// Raw samples below this are read from cold storage. Sequentially consistent, see waitForReaders.
+static uint64_t coldLength(SSG *pThis) {
+  return __atomic_load_n(&pThis->iColdBlocks, __ATOMIC_SEQ_CST) << COLD_BLOCK_LOG2;
+}
+// Calls that read raw samples announce themselves in the current epoch, so the cold storage thread can tell when
+// nobody can still be reading a block it has compressed. Two atomic adds per call, no locks.
+static int readerEnter(SSG *pThis) {
+  int iEpoch = __atomic_load_n(&pThis->iReaderEpoch, __ATOMIC_SEQ_CST) & 1;
+  __atomic_fetch_add(&pThis->aiReaders[iEpoch], 1, __ATOMIC_SEQ_CST);
+  return iEpoch;
+}
+static void readerExit(SSG *pThis, int iEpoch) {
+  __atomic_fetch_sub(&pThis->aiReaders[iEpoch], 1, __ATOMIC_RELEASE);
+}
+// Wait until every reader that may have seen the cold length before the last update has left. A reader counted
+// after the epoch flip reads the cold length after the update. Flipping twice also covers readers that picked
+// the old epoch just before the first flip.
+static void waitForReaders(SSG *pThis) {
+  int iRound;
+  for (iRound = 0; iRound < 2; iRound++) {
+    int iEpoch = __atomic_load_n(&pThis->iReaderEpoch, __ATOMIC_SEQ_CST) & 1;
+    __atomic_store_n(&pThis->iReaderEpoch, iEpoch ^ 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&pThis->aiReaders[iEpoch], __ATOMIC_SEQ_CST) != 0) usleep(100);
+  }
+}
+// Mark published samples as being rewritten, see Concurrent readers. Writer only. Waits only while a reader that
+// kept overlapping edits holds them off, and not for the readers under way.
+static void beginRewrite(SSG *pThis) {
+  for (;;) {
+    while (__atomic_load_n(&pThis->iRewriteHolds, __ATOMIC_SEQ_CST) != 0) usleep(100);
+    __atomic_store_n(&pThis->iRewrites, pThis->iRewrites + 1, __ATOMIC_SEQ_CST);
+    // A reader may have taken a hold before seeing the odd count, it reads again once this is undone
+    if (__atomic_load_n(&pThis->iRewriteHolds, __ATOMIC_SEQ_CST) == 0) break;
+    __atomic_store_n(&pThis->iRewrites, pThis->iRewrites + 1, __ATOMIC_RELEASE);
+  }
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+static void endRewrite(SSG *pThis) {
+  __atomic_store_n(&pThis->iRewrites, pThis->iRewrites + 1, __ATOMIC_RELEASE);
+}
+// Edits so far, noted by a reading call before its reads. Waits out an edit under way rather than reading what it
+// would throw away, a rebuild can take seconds.
+static uint64_t readBegin(SSG *pThis) {
+  uint64_t iRewrites;
+  while (((iRewrites = __atomic_load_n(&pThis->iRewrites, __ATOMIC_ACQUIRE)) & 1) != 0) usleep(100);
+  return iRewrites;
+}
+// After the reads of an attempt that started at iRewrites: 1 if no edit overlapped them, else 0 and the call reads
+// again. piAttempts counts the failed attempts, from 0, and takes or drops the hold on edits.
+static int readEnd(SSG *pThis, uint64_t iRewrites, int *piAttempts) {
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  if ((iRewrites & 1) == 0 && __atomic_load_n(&pThis->iRewrites, __ATOMIC_RELAXED) == iRewrites) {
+    if (*piAttempts >= READ_ATTEMPTS) __atomic_fetch_sub(&pThis->iRewriteHolds, 1, __ATOMIC_RELEASE);
+    return 1;
+  }
+  if (++*piAttempts == READ_ATTEMPTS) __atomic_fetch_add(&pThis->iRewriteHolds, 1, __ATOMIC_SEQ_CST);
   return 0;
 }
+// For a reading call that gives up before its reads are done, drops its hold on edits
+static void readAbort(SSG *pThis, int iAttempts) {
+  if (iAttempts >= READ_ATTEMPTS) __atomic_fetch_sub(&pThis->iRewriteHolds, 1, __ATOMIC_RELEASE);
+}
+// Complete entries of a level in the first iLength raw samples
+static inline uint64_t levelLength(SSG *pThis, int iLevel, uint64_t iLength) {
+  return iLength >> (iLevel * pThis->iFanoutLog2);
+}
 
+/*
+ * Retention
+ *
+ * A graph created with a retention limit keeps the newest iRetainSamples raw samples and drops older ones. Every
+ * buffer then is a ring: entry i lives in slot i % iRing, and the extents stop growing once they cover the ring, so
+ * the file keeps its size and reclaiming costs nothing. Sample positions stay absolute, the length keeps counting
+ * and the samples before the first kept one read like the ones before sample 0.
+ *
+ * A ring holds iRingSlack raw samples more than are kept, plus a few entries, so the writer can fill a block before
+ * publishing it without touching what readers may still use. A reader that takes longer than it takes to add the
+ * slack may see newer samples at the old end of its range. The writer commits before it gets a slack ahead of the
+ * last commit, so a crash always finds the kept samples of the committed length intact.
+ */
 
-int updatesize(Buffer* pMb, uint64_t iSize) {
-#ifdef DEBUGPRINTS
-  printf("updatesize(%s, %ld) - last alloced %ld ", pMb->pFilenamecopy, iSize, pMb->iAllocated);
-#endif
+// First raw sample kept of the first iLength
+static inline uint64_t retainedStart(SSG *pThis, uint64_t iLength) {
+  return iLength > pThis->iRetainSamples ? iLength - pThis->iRetainSamples : 0;
+}
+// Ring size for a buffer that holds iEntries entries behind its write pointer, in whole blocks of the base extent
+// so that groups and timestamp blocks never wrap
+static uint64_t ringEntries(uint64_t iEntries) {
+  uint64_t iMask = ((uint64_t)1 << EXTENT_BASE_LOG2) - 1;
+  return (iEntries + 16 + iMask) & ~iMask;
+}
 
-  if (!pMb->bWritable) return -1;
-  if (iSize <= pMb->iAllocated) return 0;
+/*
+ * Sample types
+ *
+ * Raw samples and LOD levels are stored in the sample type chosen at creation. The functions below take the type
+ * as an argument and are inlined into loops that are dispatched once per block, so every type gets its own loop.
+ * Min/max is exact in the stored type, values only turn into float for rendering.
+ */
 
-  uint64_t iNewTotalAlloc = (iSize + BLOCK_SIZE - 1) & (~(BLOCK_SIZE-1));
+static int sampleSize(int iType) {
+  switch (iType) {
+    case SSG_SAMPLE_FLOAT:  return sizeof(float);
+    case SSG_SAMPLE_INT8:   return sizeof(int8_t);
+    case SSG_SAMPLE_INT16:  return sizeof(int16_t);
+    case SSG_SAMPLE_HALF:   return sizeof(uint16_t);
+    case SSG_SAMPLE_DOUBLE: return sizeof(double);
+    default:                return 0;
+  }
+}
 
-#ifdef DEBUGPRINTS
-  printf("newtotalalloc %ld \n", iNewTotalAlloc);
-#endif
+// IEEE 754 binary16, round to nearest even
+static inline float halfToFloat(uint16_t iHalf) {
+  union { uint32_t i; float f; } u;
+  u.i = (uint32_t)(iHalf & 0x7fff) << 13;
+  u.f *= 5.192296858534828e+33f;             // 2^112 rebiases the exponent, subnormals included
+  if (u.f >= 65536.0f) u.i |= 0xffu << 23;  // inf, nan
+  u.i |= (uint32_t)(iHalf & 0x8000) << 16;
+  return u.f;
+}
+static inline uint16_t floatToHalf(float f) {
+  union { uint32_t i; float f; } u = { .f = f };
+  uint32_t iSign = (u.i >> 16) & 0x8000;
+  uint32_t iAbs = u.i & 0x7fffffff;
+  if (iAbs >= 0x7f800000) return (uint16_t)(iSign | 0x7c00 | (iAbs > 0x7f800000 ? 0x200 : 0)); // inf, nan
+  if (iAbs >= 0x477ff000) return (uint16_t)(iSign | 0x7c00);                                  // overflows to inf
+  if (iAbs < 0x38800000) {
+    // Subnormal or zero, the float addition does the rounding
+    union { uint32_t i; float f; } r;
+    r.i = iAbs;
+    r.f += 0.5f;
+    return (uint16_t)(iSign | (r.i - 0x3f000000));
+  }
+  iAbs += 0xc8000fff + ((iAbs >> 13) & 1); // rebias exponent and round
+  return (uint16_t)(iSign | (iAbs >> 13));
+}
+
+// Compare and combine in the widest type the stored values need
+typedef double SampleValue;
 
-  ftruncate(pMb->fd, iNewTotalAlloc*sizeof(float));
+static inline SampleValue loadValue(const void *pBase, uint64_t i, int iType) {
+  switch (iType) {
+    case SSG_SAMPLE_INT8:   return ((const int8_t*)pBase)[i];
+    case SSG_SAMPLE_INT16:  return ((const int16_t*)pBase)[i];
+    case SSG_SAMPLE_HALF:   return halfToFloat(((const uint16_t*)pBase)[i]);
+    case SSG_SAMPLE_DOUBLE: return ((const double*)pBase)[i];
+    default:                return ((const float*)pBase)[i];
+  }
+}
+static inline void storeValue(void *pBase, uint64_t i, SampleValue v, int iType) {
+  switch (iType) {
+    case SSG_SAMPLE_INT8:   ((int8_t*)pBase)[i] = (int8_t)v; break;
+    case SSG_SAMPLE_INT16:  ((int16_t*)pBase)[i] = (int16_t)v; break;
+    case SSG_SAMPLE_HALF:   ((uint16_t*)pBase)[i] = floatToHalf((float)v); break;
+    case SSG_SAMPLE_DOUBLE: ((double*)pBase)[i] = v; break;
+    default:                ((float*)pBase)[i] = (float)v; break;
+  }
+}
+static inline float loadFloat(const void *pBase, uint64_t i, int iType) {
+  if (iType == SSG_SAMPLE_FLOAT) return ((const float*)pBase)[i];
+  return (float)loadValue(pBase, i, iType);
+}
+// Physical value to the stored type, rounded and saturated for the integer types
+static inline void encodeValue(SSG *pThis, void *pBase, uint64_t i, float fValue, int iType) {
+  double d = ((double)fValue - pThis->dOffset) / pThis->dScale;
+  switch (iType) {
+    case SSG_SAMPLE_INT8:
+      d = rint(d);
+      ((int8_t*)pBase)[i] = (int8_t)(d >= INT8_MAX ? INT8_MAX : (d > INT8_MIN ? d : INT8_MIN));
+      break;
+    case SSG_SAMPLE_INT16:
+      d = rint(d);
+      ((int16_t*)pBase)[i] = (int16_t)(d >= INT16_MAX ? INT16_MAX : (d > INT16_MIN ? d : INT16_MIN));
+      break;
+    default:
+      storeValue(pBase, i, d, iType);
+      break;
+  }
+}
 
-  uint64_t iNewExtraAlloc = iNewTotalAlloc - pMb->iAllocated;
+/*
+ * Statistics
+ *
+ * Counters are only touched when statistics are enabled, and then once per map, sync or render call, never per
+ * sample or column. Renders may run on several threads at once, so all counters are updated with relaxed atomics.
+ */
 
-#ifdef EXPERIMENTAL_TAIL_ALLOC
-  float* pfTail = mmap (pMb->pfBuffer + pMb->iAllocated, iNewExtraAlloc*sizeof(float), PROT_READ | PROT_WRITE, MAP_SHARED, pMb->fd, pMb->iAllocated * sizeof(float));
-  // TODO: Handle error
-  if (pfTail == MAP_FAILED) printf("%d: %s\n", errno, strerror(errno));
+static inline int statsEnabled(SSG *pThis) {
+  return __atomic_load_n(&pThis->bStats, __ATOMIC_RELAXED);
+}
+static uint64_t statsClock(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+static void statsAdd(uint64_t *piCounter, uint64_t iValue) {
+  __atomic_fetch_add(piCounter, iValue, __ATOMIC_RELAXED);
+}
+static uint64_t statsGet(uint64_t *piCounter) {
+  return __atomic_load_n(piCounter, __ATOMIC_RELAXED);
+}
+static void statsMax(uint64_t *piCounter, uint64_t iValue) {
+  uint64_t iOld = statsGet(piCounter);
+  while (iOld < iValue && !__atomic_compare_exchange_n(piCounter, &iOld, iValue, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
 
+typedef struct {
+  int bEnabled;
+  uint64_t iStart;
+  struct rusage usage;
+} RenderStats;
 
-  if (pfTail != (pMb->pfBuffer + pMb->iAllocated)) {
-    munmap(pfTail, iNewExtraAlloc*sizeof(float));
+// Page faults are counted on the calling thread, worker pool threads are not seen
+static void getThreadUsage(struct rusage *pUsage) {
+#ifdef RUSAGE_THREAD
+  getrusage(RUSAGE_THREAD, pUsage);
+#else
+  getrusage(RUSAGE_SELF, pUsage);
 #endif
+}
+static void renderStatsBegin(SSG *pThis, RenderStats *pStats) {
+  pStats->bEnabled = statsEnabled(pThis);
+  if (!pStats->bEnabled) return;
+  getThreadUsage(&pStats->usage);
+  pStats->iStart = statsClock();
+}
+static void renderStatsEnd(SSG *pThis, const RenderStats *pStats, int iLod, uint64_t iColumns) {
+  struct rusage usage;
+  if (!pStats->bEnabled) return;
+  uint64_t iNs = statsClock() - pStats->iStart;
+  getThreadUsage(&usage);
+  iLod = MIN(iLod, SSG_STATS_LEVELS-1);
+  statsAdd(&pThis->stats.iRenders, 1);
+  statsAdd(&pThis->stats.iRenderNs, iNs);
+  statsMax(&pThis->stats.iMaxRenderNs, iNs);
+  statsAdd(&pThis->stats.iColumnsRendered, iColumns);
+  __atomic_store_n(&pThis->stats.iLastLod, (uint64_t)iLod, __ATOMIC_RELAXED);
+  statsAdd(&pThis->stats.aiRendersPerLod[iLod], 1);
+  statsAdd(&pThis->stats.iRenderMinorFaults, usage.ru_minflt - pStats->usage.ru_minflt);
+  statsAdd(&pThis->stats.iRenderMajorFaults, usage.ru_majflt - pStats->usage.ru_majflt);
+}
+
+// Pointer to a file range, mapping a new window at the range if no existing window covers it
+static void *mapFileRange(SSG *pThis, uint64_t iOffset, uint64_t iSize) {
+  uint64_t iPageSize = (uint64_t)sysconf(_SC_PAGESIZE);
+  uint64_t iMapped = 0;
+  Window *pW;
+  int i;
 
-    // Release mapping and create a new one.
-    msync(pMb->pfBuffer, pMb->iAllocated*sizeof(float), MS_SYNC);
-    munmap(pMb->pfBuffer, pMb->iAllocated*sizeof(float));
-    pMb->pfBuffer = mmap (0, iNewTotalAlloc*sizeof(float), PROT_READ | PROT_WRITE, MAP_SHARED, pMb->fd, 0);
-    if (pMb->pfBuffer == MAP_FAILED) printf("%d: %s\n", errno, strerror(errno));
-    // TODO: Handle error
-#ifdef EXPERIMENTAL_TAIL_ALLOC
+  for (i = 0; i < pThis->iWindows; i++) {
+    pW = &pThis->aWindows[i];
+    if (iOffset >= pW->iOffset && iOffset + iSize <= pW->iOffset + pW->iSize) return pW->pBase + (iOffset - pW->iOffset);
+    iMapped += pW->iSize;
   }
-#endif
+  if (pThis->iWindows == MAX_WINDOWS) return NULL;
 
-  pMb->iAllocated = iNewTotalAlloc;
-  return 0;
+  pW = &pThis->aWindows[pThis->iWindows];
+  pW->iOffset = iOffset & ~(iPageSize - 1);
+  pW->iSize = iOffset + iSize - pW->iOffset;
+  if (pThis->bWritable) {
+    // Map ahead of the file end, growing geometrically so a graph ends up with a few dozen windows at most
+    pW->iSize = MAX(pW->iSize, MAX(iMapped, MIN_WINDOW_SIZE));
+  }
+  pW->iSize = (pW->iSize + iPageSize - 1) & ~(iPageSize - 1);
+  uint64_t iStart = statsEnabled(pThis) ? statsClock() : 0;
+  pW->pBase = mmap(0, pW->iSize, PROT_READ | (pThis->bWritable?PROT_WRITE:0), MAP_SHARED | MAP_NORESERVE, pThis->fd, pW->iOffset);
+  if (pW->pBase == MAP_FAILED) {
+    printf("%d: %s\n", errno, strerror(errno));
+    return NULL;
+  }
+  if (iStart != 0) {
+    statsAdd(&pThis->stats.iMaps, 1);
+    statsAdd(&pThis->stats.iMapNs, statsClock() - iStart);
+  }
+  __atomic_store_n(&pThis->iWindows, pThis->iWindows + 1, __ATOMIC_RELEASE); // SSG_GetStats reads it
+  return pW->pBase + (iOffset - pW->iOffset);
 }
 
-int releasememblock(Buffer *pB) {
+// Make the file at least iSize bytes. It grows sparse, in steps of a quarter of its size, so the blocks of an
+// extent are only allocated as they are written. Small files double instead, a graph of a few thousand samples
+// stays a few hundred KB: the hole past the data is not free, page faults read ahead into it.
+static int growFile(SSG *pThis, uint64_t iSize) {
+  uint64_t iCapacity = pThis->iFileCapacity;
+  if (iSize <= iCapacity) return 0;
+  iCapacity = MAX(iSize, iCapacity + MIN(MAX(iCapacity / 4, MIN(iCapacity, MIN_FILE_GROWTH)), MAX_FILE_GROWTH));
+  uint64_t iStart = statsEnabled(pThis) ? statsClock() : 0;
+  if (ftruncate(pThis->fd, iCapacity) != 0) return -1;
+  if (iStart != 0) {
+    statsAdd(&pThis->stats.iFileGrowths, 1);
+    statsAdd(&pThis->stats.iFileGrowthNs, statsClock() - iStart);
+  }
+  __atomic_store_n(&pThis->iFileCapacity, iCapacity, __ATOMIC_RELAXED);
+  return 0;
+}
 
-  if (pB->bWritable) {
-    // truncate file to only used part.
-    ftruncate(pB->fd, pB->iWritePointer * sizeof(float));
+static void setAllocated(Buffer *pB) {
+  pB->iAllocated = extentStart(pB->iExtents);
+  if (pB->iRing != 0 && pB->iAllocated >= pB->iRing) pB->iAllocated = UINT64_MAX;
+}
+// Pointer to iBytes of new space at the end of the file and its offset. Caller holds allocLock.
+static void *allocFileRange(SSG *pThis, uint64_t iBytes, uint64_t *piOffset) {
+  uint64_t iOffset = pThis->iFileSize;
+  void *pRange;
+  if (growFile(pThis, iOffset + iBytes) != 0 || (pRange = mapFileRange(pThis, iOffset, iBytes)) == NULL) return NULL;
+  pThis->iFileSize = iOffset + iBytes;
+  pThis->pHeader->iDataEnd = pThis->iFileSize;
+  *piOffset = iOffset;
+  return pRange;
+}
+// Hand out an extent table for a buffer, see Container file. Caller holds allocLock.
+static int allocExtentTable(SSG *pThis, Buffer *pB, ContainerLevel *pDir) {
+  ContainerHeader *pHeader = pThis->pHeader;
+  uint64_t iOffset;
+  if (pHeader->iTableNext + EXTENT_TABLE_SIZE > pHeader->iTableEnd) {
+    if (allocFileRange(pThis, EXTENT_TABLE_BLOCK, &iOffset) == NULL) return -1;
+    pHeader->iTableNext = iOffset;
+    pHeader->iTableEnd = iOffset + EXTENT_TABLE_BLOCK;
   }
+  pB->piExtentOffset = mapFileRange(pThis, pHeader->iTableNext, EXTENT_TABLE_SIZE);
+  if (pB->piExtentOffset == NULL) return -1;
+  pDir->iExtentTable = pHeader->iTableNext;
+  pHeader->iTableNext += EXTENT_TABLE_SIZE;
+  return 0;
+}
+static int addExtent(SSG *pThis, Buffer *pB, ContainerLevel *pDir) {
+  int iExtent = pB->iExtents;
+  uint64_t iBytes = (uint64_t)pB->iEntrySize << (EXTENT_BASE_LOG2 + iExtent);
+  uint64_t iOffset;
+  uint8_t *pExtent;
 
-  msync(pB->pfBuffer, pB->iAllocated*sizeof(float), MS_SYNC);
-  munmap(pB->pfBuffer, pB->iAllocated*sizeof(float));
+  if (!pThis->bWritable || iExtent >= MAX_EXTENTS) return -1;
+  pthread_mutex_lock(&pThis->allocLock);
+  if ((pB->piExtentOffset == NULL && allocExtentTable(pThis, pB, pDir) != 0) ||
+      (pExtent = allocFileRange(pThis, iBytes, &iOffset)) == NULL) {
+    pthread_mutex_unlock(&pThis->allocLock);
+    return -1;
+  }
+  pthread_mutex_unlock(&pThis->allocLock);
 
-  close(pB->fd);
+  pB->apExtent[iExtent] = pExtent;
+  __atomic_store_n(&pB->iExtents, iExtent + 1, __ATOMIC_RELAXED);
+  setAllocated(pB);
+  pB->piExtentOffset[iExtent] = iOffset;
+  pDir->iExtents = pB->iExtents;
+  return 0;
+}
 
-  pB->fd = 0;
-  pB->pfBuffer = NULL;
-  pB->iAllocated = 0;
-  pB->iWritePointer = 0;
+static int reserveBuffer(SSG *pThis, Buffer *pB, ContainerLevel *pDir, uint64_t iSize) {
+  while (pB->iAllocated < iSize) {
+    if (addExtent(pThis, pB, pDir) != 0) return -1;
+  }
   return 0;
 }
+static int reserveEntries(SSG *pThis, int iLevel, uint64_t iSize) {
+  return reserveBuffer(pThis, levelBuffer(pThis, iLevel), &pThis->pHeader->aLevels[iLevel], iSize);
+}
+static int reserveMoments(SSG *pThis, int iLevel, uint64_t iSize) {
+  return reserveBuffer(pThis, momentBuffer(pThis, iLevel), &pThis->pHeader->aMomentLevels[iLevel], iSize);
+}
 
-#define MAX_MIP_LOD 24
+/*
+ * Durability
+ *
+ * The header holds the committed length of every level, and a crash loses what was added after the last commit
+ * but nothing before it. A commit makes the data, the extent directory and the file size durable first, and only
+ * then writes the lengths and syncs the header, so whichever header pages reach the disk, no length covers data that
+ * did not. The lengths all follow from one published length, so a commit may run on the flusher thread while the
+ * writer adds samples. Adding samples never waits for the disk, except to keep a ring from overwriting committed
+ * samples, see Retention. Edits in place mark bRewritten, which makes a commit due like added samples do. They have
+ * no length to hide behind, so a crash during an edit or before the commit after it may leave the edited raw
+ * samples and the levels over them disagreeing, until SSG_RebuildLods.
+ */
 
-#define MIN(a,b) (((a)<(b))?(a):(b))
-#define MAX(a,b) (((a)>(b))?(a):(b))
+// Entries of the timestamp index for iLength frames, the last block may be partial
+static uint64_t timeBlocks(uint64_t iLength) {
+  return (iLength + (1 << TIME_BLOCK_LOG2) - 1) >> TIME_BLOCK_LOG2;
+}
+
+static uint64_t committedLength(SSG *pThis) {
+  return __atomic_load_n(&pThis->iCommittedLength, __ATOMIC_ACQUIRE);
+}
+
+// Commit the published length. Any thread, one at a time.
+static int commitContainer(SSG *pThis) {
+  ContainerHeader *pHeader = pThis->pHeader;
+  int iLevel, iResult = 0;
+
+  pthread_mutex_lock(&pThis->commitLock);
+  uint64_t iStart = statsEnabled(pThis) ? statsClock() : 0;
+  uint64_t iLength = publishedLength(pThis);
+  if (fdatasync(pThis->fd) != 0) {
+    iResult = -1;
+  } else {
+    for (iLevel = 0; iLevel <= pThis->iLevels; iLevel++) {
+      pHeader->aLevels[iLevel].iLength = levelLength(pThis, iLevel, iLength);
+    }
+    if (pThis->bTimestamps) {
+      pHeader->times.iLength = iLength;
+      pHeader->timeIndex.iLength = timeBlocks(iLength);
+    }
+    if (pThis->iMomentLog2 != 0) {
+      for (iLevel = pThis->iMomentLog2 / pThis->iFanoutLog2; iLevel <= pThis->iLevels; iLevel++) {
+        pHeader->aMomentLevels[iLevel].iLength = levelLength(pThis, iLevel, iLength);
+      }
+    }
+    if (msync(pHeader, pHeader->iHeaderSize, MS_SYNC) != 0) iResult = -1;
+  }
+  if (iResult == 0) __atomic_store_n(&pThis->iCommittedLength, iLength, __ATOMIC_RELEASE);
+  if (iStart != 0) {
+    statsAdd(&pThis->stats.iSyncs, 1);
+    statsAdd(&pThis->stats.iSyncNs, statsClock() - iStart);
+  }
+  pthread_mutex_unlock(&pThis->commitLock);
+  return iResult;
+}
+
+// Whether anything was added or rewritten since the last commit
+static int commitDue(SSG *pThis) {
+  return publishedLength(pThis) != committedLength(pThis) || __atomic_load_n(&pThis->bRewritten, __ATOMIC_ACQUIRE);
+}
+// Commit, including the edits made so far. Any thread, an edit that ends meanwhile is marked for the next commit.
+static int commitEdits(SSG *pThis) {
+  int bRewritten = __atomic_exchange_n(&pThis->bRewritten, 0, __ATOMIC_ACQ_REL);
+  uint64_t iRewrittenBytes = __atomic_exchange_n(&pThis->iRewrittenBytes, 0, __ATOMIC_RELAXED);
+  if (commitContainer(pThis) == 0) return 0;
+  if (bRewritten) __atomic_store_n(&pThis->bRewritten, 1, __ATOMIC_RELEASE);
+  __atomic_fetch_add(&pThis->iRewrittenBytes, iRewrittenBytes, __ATOMIC_RELAXED);
+  return -1;
+}
+
+// With retention, commit before writing raw samples up to iEnd would overwrite kept samples of the last commit
+static inline void commitBeforeOverwrite(SSG *pThis, uint64_t iEnd) {
+  if (iEnd - committedLength(pThis) > pThis->iRingSlack) commitContainer(pThis);
+}
+
+// Commit, or with bWait 0 only start writeback. The lengths then follow with the next commit.
+static int flushContainer(SSG *pThis, int bWait) {
+  int i, iResult = 0;
+  if (!pThis->bWritable) return 0;
+  if (bWait) return commitEdits(pThis);
+  uint64_t iStart = statsEnabled(pThis) ? statsClock() : 0;
+  pthread_mutex_lock(&pThis->allocLock);
+  for (i = 0; i < pThis->iWindows; i++) {
+    Window *pW = &pThis->aWindows[i];
+    if (pW->iOffset < pThis->iFileSize) {
+      if (msync(pW->pBase, MIN(pW->iSize, pThis->iFileSize - pW->iOffset), MS_ASYNC) != 0) iResult = -1;
+    }
+  }
+  pthread_mutex_unlock(&pThis->allocLock);
+  if (iStart != 0) {
+    statsAdd(&pThis->stats.iSyncs, 1);
+    statsAdd(&pThis->stats.iSyncNs, statsClock() - iStart);
+  }
+  return iResult;
+}
+
+static void *flushWorker(void *pArg) {
+  SSG *pThis = pArg;
 
+  pthread_mutex_lock(&pThis->flushLock);
+  while (!pThis->bFlushStop) {
+    int iWaitMs = pThis->iFlushIntervalMs > 0 ? pThis->iFlushIntervalMs : FLUSH_POLL_MS;
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += iWaitMs / 1000;
+    ts.tv_nsec += (iWaitMs % 1000) * 1000000L;
+    ts.tv_sec += ts.tv_nsec / 1000000000L;
+    ts.tv_nsec %= 1000000000L;
+    int bTimeout = pthread_cond_timedwait(&pThis->flushWake, &pThis->flushLock, &ts) == ETIMEDOUT;
+    int bRequested = __atomic_exchange_n(&pThis->bFlushRequested, 0, __ATOMIC_ACQ_REL);
+    if (pThis->bFlushStop || !commitDue(pThis)) continue;
+    if (!bRequested && !(bTimeout && pThis->iFlushIntervalMs > 0)) continue;
+    pthread_mutex_unlock(&pThis->flushLock);
+    if (commitEdits(pThis) != 0) printf("%d: %s\n", errno, strerror(errno));
+    pthread_mutex_lock(&pThis->flushLock);
+  }
+  pthread_mutex_unlock(&pThis->flushLock);
+  return NULL;
+}
+
+static void stopFlushThread(SSG *pThis) {
+  pthread_mutex_lock(&pThis->flushLock);
+  int bRunning = pThis->bFlushThread;
+  pThis->bFlushStop = 1;
+  pthread_cond_signal(&pThis->flushWake);
+  pthread_mutex_unlock(&pThis->flushLock);
+  if (bRunning) pthread_join(pThis->flushThread, NULL);
+  pThis->bFlushThread = 0;
+}
+
+// Called by the writer after publishing or an edit, wakes the flusher once enough raw bytes are uncommitted. Never
+// blocks.
+static void requestFlush(SSG *pThis) {
+  uint64_t iPending = (publishedLength(pThis) - committedLength(pThis)) * pThis->samples.iEntrySize +
+                      __atomic_load_n(&pThis->iRewrittenBytes, __ATOMIC_RELAXED);
+  if (iPending >= pThis->iFlushBytes && !__atomic_load_n(&pThis->bFlushRequested, __ATOMIC_RELAXED)) {
+    __atomic_store_n(&pThis->bFlushRequested, 1, __ATOMIC_RELEASE);
+    pthread_cond_signal(&pThis->flushWake);
+  }
+}
+
+/*
+ * Cold storage
+ *
+ * Old raw samples are rarely read: zoomed out renders only read the LOD levels. With cold storage on, a thread
+ * compresses blocks of 2^COLD_BLOCK_LOG2 raw frames older than the newest iHotSamples into coldData, and punches
+ * the raw copies out of the file, which gives their disk space and page cache back. The LOD levels stay as they are.
+ * The values of a channel are turned into residuals, the XOR with the previous value for the floating point types
+ * and the zigzagged difference for the integer types, and each COLD_GROUP residuals are bit packed with the width of
+ * the largest one, less the trailing zero bits they all share. Raw samples below the cold length are read through a
+ * small cache of decompressed blocks.
+ */
 
 typedef struct {
-  Buffer minBuffer;
-  Buffer maxBuffer;
-} LodBuffer;
+  uint32_t iBytes;  // including this header
+  uint32_t iFormat; // COLD_FORMAT_*
+} ColdBlockHeader;
 
-struct SSG_private {
-  Buffer samples;
-  LodBuffer aLodBuffers[MAX_MIP_LOD];
-  uint8_t aiGammaxlat[256];
-  int bWritable;
-};
+#define COLD_FORMAT_RAW    0 // frames as they are, for blocks that don't pack smaller
+#define COLD_FORMAT_PACKED 1
 
-SSG *SSG_New(char *pcBasefilename, int bWritable) {
-  int i;
-  SSG *pThis = calloc(sizeof(SSG), 1);
-  for (i=0; i<256; i++) {
-    pThis->aiGammaxlat[i] = (uint8_t)sqrt(256*i);
+typedef struct {
+  uint8_t *p;
+  uint64_t iAcc;
+  int iBits;
+} BitStream;
+
+// n <= 32 and v < 2^n
+static inline void putBits32(BitStream *pS, uint64_t v, int n) {
+  pS->iAcc |= v << pS->iBits;
+  pS->iBits += n;
+  while (pS->iBits >= 8) {
+    *pS->p++ = (uint8_t)pS->iAcc;
+    pS->iAcc >>= 8;
+    pS->iBits -= 8;
   }
-  char acFilename[1024];
-  sprintf(acFilename, "%s_rawsamples.bin", pcBasefilename);
-  mapfiletomemblock(acFilename, &pThis->samples, bWritable);
-  for (i=0; i<MAX_MIP_LOD; i++) {
-    sprintf(acFilename, "%s_LOD_%d_MIN.bin", pcBasefilename, i);
-    mapfiletomemblock(acFilename, &pThis->aLodBuffers[i].minBuffer, bWritable);
-    sprintf(acFilename, "%s_LOD_%d_MAX.bin", pcBasefilename, i);
-    mapfiletomemblock(acFilename, &pThis->aLodBuffers[i].maxBuffer, bWritable);
+}
+static inline void putBits(BitStream *pS, uint64_t v, int n) {
+  if (n > 32) {
+    putBits32(pS, v & 0xffffffffu, 32);
+    v >>= 32;
+    n -= 32;
+  }
+  putBits32(pS, v, n);
+}
+static inline uint64_t getBits32(BitStream *pS, int n) {
+  uint64_t v;
+  while (pS->iBits < n) {
+    pS->iAcc |= (uint64_t)*pS->p++ << pS->iBits;
+    pS->iBits += 8;
+  }
+  v = pS->iAcc & ((1ULL << n) - 1);
+  pS->iAcc >>= n;
+  pS->iBits -= n;
+  return v;
+}
+static inline uint64_t getBits(BitStream *pS, int n) {
+  if (n > 32) {
+    uint64_t iLow = getBits32(pS, 32);
+    return iLow | (getBits32(pS, n - 32) << 32);
   }
+  return getBits32(pS, n);
+}
 
-  return pThis;
+// Stored value as bits, integers sign extended
+static inline uint64_t loadBits(const void *pBase, uint64_t i, int iType) {
+  switch (iType) {
+    case SSG_SAMPLE_INT8:   return (uint64_t)(int64_t)((const int8_t*)pBase)[i];
+    case SSG_SAMPLE_INT16:  return (uint64_t)(int64_t)((const int16_t*)pBase)[i];
+    case SSG_SAMPLE_HALF:   return ((const uint16_t*)pBase)[i];
+    case SSG_SAMPLE_DOUBLE: return ((const uint64_t*)pBase)[i];
+    default:                return ((const uint32_t*)pBase)[i];
+  }
+}
+static inline void storeBits(void *pBase, uint64_t i, uint64_t v, int iType) {
+  switch (iType) {
+    case SSG_SAMPLE_INT8:   ((uint8_t*)pBase)[i] = (uint8_t)v; break;
+    case SSG_SAMPLE_INT16:
+    case SSG_SAMPLE_HALF:   ((uint16_t*)pBase)[i] = (uint16_t)v; break;
+    case SSG_SAMPLE_DOUBLE: ((uint64_t*)pBase)[i] = v; break;
+    default:                ((uint32_t*)pBase)[i] = (uint32_t)v; break;
+  }
+}
+static inline uint64_t residual(uint64_t v, uint64_t iPrev, int iType) {
+  if (iType == SSG_SAMPLE_INT8 || iType == SSG_SAMPLE_INT16) {
+    int64_t d = (int64_t)(v - iPrev);
+    return ((uint64_t)d << 1) ^ (uint64_t)(d >> 63);
+  }
+  return v ^ iPrev;
+}
+static inline uint64_t unresidual(uint64_t u, uint64_t iPrev, int iType) {
+  if (iType == SSG_SAMPLE_INT8 || iType == SSG_SAMPLE_INT16) return iPrev + ((u >> 1) ^ (0 - (u & 1)));
+  return u ^ iPrev;
 }
 
-void SSG_Teardown(SSG* pThis) {
+__attribute__((always_inline))
+static inline uint8_t *packBlockType(const void *pFrames, uint8_t *pOut, int iChannels, int iType) {
+  BitStream s = { pOut, 0, 0 };
+  uint64_t au[COLD_GROUP];
+  int c, g, j;
+  for (c = 0; c < iChannels; c++) {
+    uint64_t iPrev = 0;
+    for (g = 0; g < (1 << COLD_BLOCK_LOG2); g += COLD_GROUP) {
+      uint64_t iOr = 0;
+      for (j = 0; j < COLD_GROUP; j++) {
+        uint64_t v = loadBits(pFrames, (uint64_t)(g + j) * iChannels + c, iType);
+        au[j] = residual(v, iPrev, iType);
+        iPrev = v;
+        iOr |= au[j];
+      }
+      int iShift = iOr ? __builtin_ctzll(iOr) : 0;
+      int iWidth = iOr ? 64 - __builtin_clzll(iOr) - iShift : 0;
+      putBits32(&s, iShift, 6);
+      putBits32(&s, iWidth, 7);
+      for (j = 0; j < COLD_GROUP; j++) putBits(&s, au[j] >> iShift, iWidth);
+    }
+  }
+  if (s.iBits > 0) *s.p++ = (uint8_t)s.iAcc;
+  return s.p;
+}
+__attribute__((always_inline))
+static inline void unpackBlockType(const uint8_t *pIn, void *pFrames, int iChannels, int iType) {
+  BitStream s = { (uint8_t*)pIn, 0, 0 };
+  int c, g, j;
+  for (c = 0; c < iChannels; c++) {
+    uint64_t iPrev = 0;
+    for (g = 0; g < (1 << COLD_BLOCK_LOG2); g += COLD_GROUP) {
+      int iShift = (int)getBits32(&s, 6);
+      int iWidth = (int)getBits32(&s, 7);
+      for (j = 0; j < COLD_GROUP; j++) {
+        iPrev = unresidual(getBits(&s, iWidth) << iShift, iPrev, iType);
+        storeBits(pFrames, (uint64_t)(g + j) * iChannels + c, iPrev, iType);
+      }
+    }
+  }
+}
+
+// Largest compressed block, a packed block may come out bigger than the raw frames before it is stored raw instead
+static size_t coldBlockBound(SSG *pThis) {
+  size_t iGroups = ((size_t)pThis->iChannels << COLD_BLOCK_LOG2) / COLD_GROUP;
+  return sizeof(ColdBlockHeader) + iGroups * (2 + COLD_GROUP * sizeof(uint64_t)) + 1;
+}
+// Compress the block of raw frames at pFrames into pOut, returns the bytes used
+static uint32_t packBlock(SSG *pThis, const void *pFrames, uint8_t *pOut) {
+  ColdBlockHeader *pHeader = (ColdBlockHeader*)pOut;
+  uint8_t *pData = pOut + sizeof(ColdBlockHeader);
+  size_t iRawBytes = (size_t)pThis->samples.iEntrySize << COLD_BLOCK_LOG2;
+  uint8_t *pEnd;
+  switch (pThis->iSampleType) {
+    case SSG_SAMPLE_INT8:   pEnd = packBlockType(pFrames, pData, pThis->iChannels, SSG_SAMPLE_INT8);   break;
+    case SSG_SAMPLE_INT16:  pEnd = packBlockType(pFrames, pData, pThis->iChannels, SSG_SAMPLE_INT16);  break;
+    case SSG_SAMPLE_HALF:   pEnd = packBlockType(pFrames, pData, pThis->iChannels, SSG_SAMPLE_HALF);   break;
+    case SSG_SAMPLE_DOUBLE: pEnd = packBlockType(pFrames, pData, pThis->iChannels, SSG_SAMPLE_DOUBLE); break;
+    default:                pEnd = packBlockType(pFrames, pData, pThis->iChannels, SSG_SAMPLE_FLOAT);  break;
+  }
+  pHeader->iFormat = COLD_FORMAT_PACKED;
+  if ((size_t)(pEnd - pData) >= iRawBytes) {
+    memcpy(pData, pFrames, iRawBytes);
+    pEnd = pData + iRawBytes;
+    pHeader->iFormat = COLD_FORMAT_RAW;
+  }
+  pHeader->iBytes = (uint32_t)(pEnd - pOut);
+  return pHeader->iBytes;
+}
+// Decompress cold block iBlock into pFrames. Cold blocks never change once published, so this needs no lock.
+static void unpackColdBlock(SSG *pThis, uint64_t iBlock, void *pFrames) {
+  uint64_t iOffset = *(const uint64_t*)entryPtr(&pThis->coldIndex, iBlock);
+  const ColdBlockHeader *pHeader = entryPtr(&pThis->coldData, iOffset);
+  const uint8_t *pData = (const uint8_t*)(pHeader + 1);
+  if (pHeader->iFormat == COLD_FORMAT_RAW) {
+    memcpy(pFrames, pData, (size_t)pThis->samples.iEntrySize << COLD_BLOCK_LOG2);
+    return;
+  }
+  switch (pThis->iSampleType) {
+    case SSG_SAMPLE_INT8:   unpackBlockType(pData, pFrames, pThis->iChannels, SSG_SAMPLE_INT8);   break;
+    case SSG_SAMPLE_INT16:  unpackBlockType(pData, pFrames, pThis->iChannels, SSG_SAMPLE_INT16);  break;
+    case SSG_SAMPLE_HALF:   unpackBlockType(pData, pFrames, pThis->iChannels, SSG_SAMPLE_HALF);   break;
+    case SSG_SAMPLE_DOUBLE: unpackBlockType(pData, pFrames, pThis->iChannels, SSG_SAMPLE_DOUBLE); break;
+    default:                unpackBlockType(pData, pFrames, pThis->iChannels, SSG_SAMPLE_FLOAT);  break;
+  }
+}
+
+// Raw frames of cold block iBlock from the cache, decompressed into the least recently used entry on a miss.
+// Caller holds coldLock. NULL if out of memory.
+static const uint8_t *cachedColdBlock(SSG *pThis, uint64_t iBlock) {
+  ColdCacheEntry *pEntry = &pThis->aColdCache[0];
   int i;
+  for (i = 0; i < COLD_CACHE_BLOCKS; i++) {
+    ColdCacheEntry *pE = &pThis->aColdCache[i];
+    if (pE->iBlock == (int64_t)iBlock) {
+      pE->iUsed = ++pThis->iColdCacheClock;
+      return pE->pFrames;
+    }
+    if (pE->iUsed < pEntry->iUsed) pEntry = pE;
+  }
+  if (pEntry->pFrames == NULL) {
+    pEntry->pFrames = malloc((size_t)pThis->samples.iEntrySize << COLD_BLOCK_LOG2);
+    if (pEntry->pFrames == NULL) return NULL;
+  }
+  unpackColdBlock(pThis, iBlock, pEntry->pFrames);
+  pEntry->iBlock = (int64_t)iBlock;
+  pEntry->iUsed = ++pThis->iColdCacheClock;
+  if (statsEnabled(pThis)) statsAdd(&pThis->stats.iColdCacheMisses, 1);
+  return pEntry->pFrames;
+}
+// Min and max of iCount raw frames from iFirst, all in one cold block, per channel
+__attribute__((noinline))
+static void getColdSamples(SSG *pThis, uint64_t iFirst, int iCount, float *pfOutMin, float *pfOutMax, int iChannels) {
+  int c, i;
+  pthread_mutex_lock(&pThis->coldLock);
+  const uint8_t *pFrames = cachedColdBlock(pThis, iFirst >> COLD_BLOCK_LOG2);
+  for (c = 0; c < iChannels; c++) {
+    float fMin = 0.0f, fMax = 0.0f;
+    if (pFrames != NULL) {
+      const uint8_t *pEntry = pFrames + (iFirst & ((1 << COLD_BLOCK_LOG2) - 1)) * pThis->samples.iEntrySize;
+      fMin = fMax = loadFloat(pEntry, c, pThis->iSampleType);
+      for (i = 1; i < iCount; i++) {
+        float f = loadFloat(pEntry, i*pThis->iChannels + c, pThis->iSampleType);
+        fMin = MIN(fMin, f);
+        fMax = MAX(fMax, f);
+      }
+    }
+    pfOutMin[c] = fMin;
+    pfOutMax[c] = fMax;
+  }
+  pthread_mutex_unlock(&pThis->coldLock);
+}
+// Fold raw frames [iFrom, iTo), all cold, into the running min/max of every channel
+static void combineColdEntries(SSG *pThis, uint64_t iFrom, uint64_t iTo, SampleValue *pvMin, SampleValue *pvMax) {
+  int c;
+  pthread_mutex_lock(&pThis->coldLock);
+  for (; iFrom < iTo; iFrom++) {
+    const uint8_t *pFrames = cachedColdBlock(pThis, iFrom >> COLD_BLOCK_LOG2);
+    if (pFrames == NULL) break;
+    const uint8_t *pEntry = pFrames + (iFrom & ((1 << COLD_BLOCK_LOG2) - 1)) * pThis->samples.iEntrySize;
+    for (c = 0; c < pThis->iChannels; c++) {
+      SampleValue v = loadValue(pEntry, c, pThis->iSampleType);
+      pvMin[c] = MIN(pvMin[c], v);
+      pvMax[c] = MAX(pvMax[c], v);
+    }
+  }
+  pthread_mutex_unlock(&pThis->coldLock);
+}
 
-  releasememblock(&pThis->samples);
-  for (i=0; i<MAX_MIP_LOD; i++) {
-    releasememblock(&pThis->aLodBuffers[i].minBuffer);
-    releasememblock(&pThis->aLodBuffers[i].maxBuffer);
+// msync entries [iFrom, iTo) of a buffer and wait for them to be on disk
+static int syncBufferRange(Buffer *pB, uint64_t iFrom, uint64_t iTo) {
+  uintptr_t iPageMask = (uintptr_t)sysconf(_SC_PAGESIZE) - 1;
+  int iResult = 0;
+  while (iFrom < iTo) {
+    uint64_t iRun = MIN(bufferRun(pB, iFrom), iTo - iFrom);
+    uintptr_t iStart = (uintptr_t)entryPtr(pB, iFrom);
+    uintptr_t iEnd = iStart + iRun * pB->iEntrySize;
+    if (msync((void*)(iStart & ~iPageMask), iEnd - (iStart & ~iPageMask), MS_SYNC) != 0) iResult = -1;
+    iFrom += iRun;
   }
+  return iResult;
+}
+// Give back the file blocks of raw frames [iFrom, iTo), which are cold and no longer read. Only whole pages within
+// the raw extents are punched. Frames of the same extent before iFrom are cold as well, so the first page may reach
+// back into them.
+static void punchRawFrames(SSG *pThis, uint64_t iFrom, uint64_t iTo) {
+#ifdef FALLOC_FL_PUNCH_HOLE
+  uint64_t iPageMask = (uint64_t)sysconf(_SC_PAGESIZE) - 1;
+  while (iFrom < iTo) {
+    int iExtent = extentOf(iFrom);
+    uint64_t iRun = MIN(extentRun(iFrom), iTo - iFrom);
+    uint64_t iExtentOffset = pThis->samples.piExtentOffset[iExtent];
+    uint64_t iStart = iExtentOffset + (iFrom - extentStart(iExtent)) * pThis->samples.iEntrySize;
+    uint64_t iEnd = (iStart + iRun * pThis->samples.iEntrySize) & ~iPageMask;
+    iStart = MAX(iStart & ~iPageMask, (iExtentOffset + iPageMask) & ~iPageMask);
+    if (iEnd > iStart) fallocate(pThis->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, iStart, iEnd - iStart);
+    iFrom += iRun;
+  }
+#else
+  (void)pThis; (void)iFrom; (void)iTo;
+#endif
 }
 
+// Compress raw blocks up to iEnd, publish them and drop the raw copies. Runs on the cold storage thread, the only
+// writer of the cold buffers. Returns -1 if the file can't grow.
+static int compressColdBlocks(SSG *pThis, uint64_t iEnd, uint8_t *pScratch) {
+  ContainerHeader *pHeader = pThis->pHeader;
+  uint64_t iStart = pThis->iColdBlocks;
+  uint64_t iDataStart = pThis->coldData.iWritePointer;
+  uint64_t iBlock;
+  int iResult = 0;
 
-static void addSample(SSG* pThis, float fSample, int iMode, int iLevel) {
-  Buffer* pBuffer = NULL;
-  if (iMode==0) {
-    pBuffer = &pThis->samples;
-  } else {
-    pBuffer = iMode>0 ? &pThis->aLodBuffers[iLevel-1].maxBuffer : &pThis->aLodBuffers[iLevel-1].minBuffer;
+  for (iBlock = iStart; iBlock < iEnd; iBlock++) {
+    uint32_t iBytes = packBlock(pThis, entryPtr(&pThis->samples, iBlock << COLD_BLOCK_LOG2), pScratch);
+    uint64_t iOffset = pThis->coldData.iWritePointer;
+    // A block goes in one piece into one extent
+    while (extentRun(iOffset) < iBytes) iOffset = extentStart(extentOf(iOffset) + 1);
+    if (reserveBuffer(pThis, &pThis->coldData, &pHeader->coldData, iOffset + iBytes) != 0 ||
+        reserveBuffer(pThis, &pThis->coldIndex, &pHeader->coldIndex, iBlock + 1) != 0) {
+      iResult = -1;
+      break;
+    }
+    memcpy(entryPtr(&pThis->coldData, iOffset), pScratch, iBytes);
+    *(uint64_t*)entryPtr(&pThis->coldIndex, iBlock) = iOffset;
+    __atomic_store_n(&pThis->coldData.iWritePointer, iOffset + iBytes, __ATOMIC_RELAXED); // SSG_GetStats reads it
+    pThis->coldIndex.iWritePointer = iBlock + 1;
   }
+  if (iBlock == iStart) return iResult;
 
-  if (pBuffer->iWritePointer >= pBuffer->iAllocated) {
-    updatesize(pBuffer, pBuffer->iWritePointer+1);
+  // Readers switch over right away, the raw copies stay until the compressed ones are on disk
+  pthread_mutex_lock(&pThis->allocLock);
+  pHeader->coldIndex.iLength = pThis->coldIndex.iWritePointer;
+  pHeader->coldData.iLength = pThis->coldData.iWritePointer;
+  pHeader->iColdBlocks = iBlock;
+  pthread_mutex_unlock(&pThis->allocLock);
+  __atomic_store_n(&pThis->iColdBlocks, iBlock, __ATOMIC_SEQ_CST);
+  if (syncBufferRange(&pThis->coldData, iDataStart, pThis->coldData.iWritePointer) != 0 ||
+      syncBufferRange(&pThis->coldIndex, iStart, iBlock) != 0 ||
+      msync(pHeader, pHeader->iHeaderSize, MS_SYNC) != 0) {
+    return -1;
   }
+  waitForReaders(pThis);
+  punchRawFrames(pThis, iStart << COLD_BLOCK_LOG2, iBlock << COLD_BLOCK_LOG2);
+  return iResult;
+}
 
-  pBuffer->pfBuffer[pBuffer->iWritePointer] = fSample;
-  pBuffer->iWritePointer++;
+static void *coldWorker(void *pArg) {
+  SSG *pThis = pArg;
+  uint8_t *pScratch = malloc(coldBlockBound(pThis));
 
-  if (iLevel<MAX_MIP_LOD) {
-    if ((pBuffer->iWritePointer & 1) == 0) {
-      float fSampleA = pBuffer->pfBuffer[pBuffer->iWritePointer - 2];
-      float fSampleB = pBuffer->pfBuffer[pBuffer->iWritePointer - 1];
-      if (iMode==0) {
-        addSample(pThis, MIN(fSampleA,fSampleB), -1, iLevel+1);
-        addSample(pThis, MAX(fSampleA,fSampleB),  1, iLevel+1);
-      } else if (iMode==-1) {
-        addSample(pThis, MIN(fSampleA,fSampleB), -1, iLevel+1);
-      } else {
-        addSample(pThis, MAX(fSampleA,fSampleB),  1, iLevel+1);
-      }
+  pthread_mutex_lock(&pThis->coldLock);
+  while (pScratch != NULL && !pThis->bColdStop) {
+    uint64_t iLength = publishedLength(pThis);
+    uint64_t iTarget = (iLength > pThis->iHotSamples) ? (iLength - pThis->iHotSamples) >> COLD_BLOCK_LOG2 : 0;
+    // Cold blocks only cover committed samples, a crash must not leave the header with more cold than raw ones
+    if (pThis->iColdBlocks < iTarget && (committedLength(pThis) >> COLD_BLOCK_LOG2) < iTarget) {
+      pthread_mutex_unlock(&pThis->coldLock);
+      commitContainer(pThis);
+      pthread_mutex_lock(&pThis->coldLock);
+    }
+    iTarget = MIN(iTarget, committedLength(pThis) >> COLD_BLOCK_LOG2);
+    if (pThis->iColdBlocks >= iTarget) {
+      struct timespec ts;
+      clock_gettime(CLOCK_REALTIME, &ts);
+      ts.tv_nsec += COLD_POLL_MS * 1000000L;
+      ts.tv_sec += ts.tv_nsec / 1000000000L;
+      ts.tv_nsec %= 1000000000L;
+      pthread_cond_timedwait(&pThis->coldWake, &pThis->coldLock, &ts);
+      continue;
+    }
+    pthread_mutex_unlock(&pThis->coldLock);
+    int iResult = compressColdBlocks(pThis, MIN(iTarget, pThis->iColdBlocks + COLD_BATCH), pScratch);
+    pthread_mutex_lock(&pThis->coldLock);
+    if (iResult != 0) {
+      printf("Cold storage stopped, can't write compressed blocks\n");
+      break;
     }
   }
+  pthread_mutex_unlock(&pThis->coldLock);
+  free(pScratch);
+  return NULL;
+}
+
+static void stopColdThread(SSG *pThis) {
+  pthread_mutex_lock(&pThis->coldLock);
+  int bRunning = pThis->bColdThread;
+  pThis->bColdStop = 1;
+  pthread_cond_signal(&pThis->coldWake);
+  pthread_mutex_unlock(&pThis->coldLock);
+  if (bRunning) pthread_join(pThis->coldThread, NULL);
+  pThis->bColdThread = 0;
 }
-static void getSample(SSG* pThis, int64_t iSamplePos, int iLevel, float* pfOutMin, float* pfOutMax) {
-  *pfOutMin = 0.0f;
-  *pfOutMax = 0.0f;
-  if (iLevel >= MAX_MIP_LOD) return;
 
-  Buffer *pMinB = (iLevel == 0) ? &pThis->samples : &pThis->aLodBuffers[iLevel-1].minBuffer;
-  Buffer *pMaxB = (iLevel == 0) ? &pThis->samples : &pThis->aLodBuffers[iLevel-1].maxBuffer;
+/*
+ * Timestamps
+ *
+ * A graph created with timestamps stores an int64 time per raw frame in times, non-decreasing, plus the first time
+ * of every block of 2^TIME_BLOCK_LOG2 frames in timeIndex. A lookup binary searches the index, which is small enough
+ * to stay cached, and then one block, which lies in one extent. Without timestamps a frame's time is its index.
+ * The LOD levels don't know about time: a time range maps to an index range, which is read as usual.
+ */
 
-  if (iSamplePos>=0 && iSamplePos<pMinB->iWritePointer) *pfOutMin = pMinB->pfBuffer[iSamplePos];
-  if (iSamplePos>=0 && iSamplePos<pMaxB->iWritePointer) *pfOutMax = pMaxB->pfBuffer[iSamplePos];
+static int64_t frameTime(SSG *pThis, uint64_t iIndex) {
+  if (!pThis->bTimestamps) return (int64_t)iIndex;
+  return *(const int64_t*)entryPtr(&pThis->times, iIndex);
 }
-static int linear(float v1, float v2, float f) {
-  int iv = 255.0f * (v1+(v2-v1)*f);
-  return iv;
+// First of the first iLength frames at or after iTime, iLength if none
+static uint64_t timeLowerBound(SSG *pThis, uint64_t iLength, int64_t iTime) {
+  uint64_t iStart = retainedStart(pThis, iLength);
+  uint64_t iFirstBlock = iStart >> TIME_BLOCK_LOG2;
+  uint64_t iLo = iFirstBlock, iHi;
+  if (!pThis->bTimestamps) return iTime <= (int64_t)iStart ? iStart : MIN((uint64_t)iTime, iLength);
+  // Blocks [iFirstBlock, iLo) start before iTime. The first block may start before iStart, its times are still there.
+  iHi = timeBlocks(iLength);
+  while (iLo < iHi) {
+    uint64_t iMid = iLo + (iHi - iLo) / 2;
+    if (*(const int64_t*)entryPtr(&pThis->timeIndex, iMid) < iTime) iLo = iMid + 1;
+    else iHi = iMid;
+  }
+  if (iLo == iFirstBlock) return iStart;
+  // The frame is in the last block that starts before iTime, or starts the next one
+  iHi = MIN(iLo << TIME_BLOCK_LOG2, iLength);
+  iLo = (iLo - 1) << TIME_BLOCK_LOG2;
+  const int64_t *piBlock = entryPtr(&pThis->times, iLo);
+  uint64_t iCount = iHi - iLo, i = 0;
+  while (iCount > 0) {
+    uint64_t iHalf = iCount / 2;
+    if (piBlock[i + iHalf] < iTime) {
+      i += iHalf + 1;
+      iCount -= iHalf + 1;
+    } else {
+      iCount = iHalf;
+    }
+  }
+  return MAX(iLo + i, iStart);
 }
+// Store the times of frames [iStart, iStart + iCount) and their index entries. Caller checked the order.
+static int appendTimes(SSG *pThis, uint64_t iStart, const int64_t *piTimes, uint64_t iCount) {
+  Buffer *pTimes = &pThis->times;
+  uint64_t iEnd = iStart + iCount;
+  uint64_t i;
 
+  if (reserveBuffer(pThis, pTimes, &pThis->pHeader->times, iEnd) != 0 ||
+      reserveBuffer(pThis, &pThis->timeIndex, &pThis->pHeader->timeIndex, timeBlocks(iEnd)) != 0) {
+    return -1;
+  }
+  for (i = iStart; i < iEnd; ) {
+    uint64_t iRun = MIN(iEnd - i, bufferRun(pTimes, i));
+    memcpy(entryPtr(pTimes, i), piTimes + (i - iStart), iRun * sizeof(int64_t));
+    i += iRun;
+  }
+  for (i = timeBlocks(iStart); i < timeBlocks(iEnd); i++) {
+    *(int64_t*)entryPtr(&pThis->timeIndex, i) = piTimes[(i << TIME_BLOCK_LOG2) - iStart];
+  }
+  pTimes->iWritePointer = iEnd;
+  pThis->timeIndex.iWritePointer = timeBlocks(iEnd);
+  return 0;
+}
 
+/*
+ * Prefetch
+ *
+ * A render reads a few entries per column from two levels, spread over the whole view, so a view whose pages are not
+ * in the page cache stalls on one fault after another. Prefetching passes the page ranges a view will read to the
+ * kernel with madvise(MADV_WILLNEED), which starts the reads without waiting for them. The prefetch thread does this
+ * for the views next to the last rendered one: a screen to either side, and the next finer and coarser zoom.
+ */
 
-void SSG_AddValue(SSG *pThis, float fValue) {
-  addSample(pThis, fValue, 0,0);
+// Start reading entries [iFrom, iTo) of a buffer, below the published length
+static void prefetchEntries(const Buffer *pB, uint64_t iFrom, uint64_t iTo) {
+  uintptr_t iPageMask = (uintptr_t)sysconf(_SC_PAGESIZE) - 1;
+  while (iFrom < iTo) {
+    uint64_t iRun = MIN(bufferRun(pB, iFrom), iTo - iFrom);
+    uintptr_t iStart = (uintptr_t)entryPtr(pB, iFrom) & ~iPageMask;
+    uintptr_t iEnd = (uintptr_t)entryPtr(pB, iFrom) + iRun * pB->iEntrySize;
+    madvise((void*)iStart, iEnd - iStart, MADV_WILLNEED);
+    iFrom += iRun;
+  }
 }
-uint64_t SSG_GetLength(SSG *pThis) {
-  return pThis->samples.iWritePointer;
+// Start reading what a render of raw samples [dStart, dEnd) at LOD iLod reads
+static void prefetchRange(SSG *pThis, double dStart, double dEnd, int iLod) {
+  uint64_t iLength = publishedLength(pThis);
+  uint64_t iColdLength = coldLength(pThis);
+  int iLevel, iPrevStored = -1;
+
+  iLod = MAX(iLod, 0);
+  for (iLevel = iLod; iLevel <= iLod + 1 && iLevel <= MAX_MIP_LOD; iLevel++) {
+    int iStored = MIN(iLevel / pThis->iFanoutLog2, pThis->iLevels);
+    if (iStored == iPrevStored) continue;
+    iPrevStored = iStored;
+    int iShift = iStored * pThis->iFanoutLog2;
+    double dMargin = (double)PREFETCH_MARGIN * ((uint64_t)1 << iLevel);
+    uint64_t iKept = levelLength(pThis, iStored, retainedStart(pThis, iLength));
+    uint64_t iEntries = levelLength(pThis, iStored, iLength);
+    uint64_t iFrom = (dStart - dMargin > 0.0) ? (uint64_t)(dStart - dMargin) >> iShift : 0;
+    uint64_t iTo = (dEnd + dMargin > 0.0) ? ((uint64_t)(dEnd + dMargin) >> iShift) + 1 : 0;
+    iFrom = MAX(iFrom, iKept);
+    iTo = MIN(iTo, iEntries);
+    if (iFrom >= iTo) continue;
+    if (iStored == 0 && iFrom < iColdLength) {
+      // Compressed raw frames, their index entries and data up to the start of the last block
+      uint64_t iFirstBlock = iFrom >> COLD_BLOCK_LOG2;
+      uint64_t iLastBlock = (MIN(iTo, iColdLength) - 1) >> COLD_BLOCK_LOG2;
+      prefetchEntries(&pThis->coldIndex, iFirstBlock, iLastBlock + 1);
+      prefetchEntries(&pThis->coldData, *(const uint64_t*)entryPtr(&pThis->coldIndex, iFirstBlock),
+                      *(const uint64_t*)entryPtr(&pThis->coldIndex, iLastBlock) + 1);
+      iFrom = MIN(iTo, iColdLength);
+    }
+    prefetchEntries(levelBuffer(pThis, iStored), iFrom, iTo);
+  }
 }
 
-void SSG_Render(SSG* pThis, double dLeftmostPixelSamplePos, double dRightmostPixelSamplePos, float fTopmostValue, float fBottommostValue, uint8_t *pDstBuffer, int iWidth, int iHeight) {
+static void *prefetchWorker(void *pArg) {
+  SSG *pThis = pArg;
+  double dDoneLeft = 0.0, dDoneRight = 0.0;
+  int iDoneLod = -1;
 
+  pthread_mutex_lock(&pThis->prefetchLock);
+  while (!pThis->bPrefetchStop) {
+    if (!pThis->bPrefetchPending) {
+      pthread_cond_wait(&pThis->prefetchWake, &pThis->prefetchLock);
+      continue;
+    }
+    double dLeft = pThis->dPrefetchLeft, dRight = pThis->dPrefetchRight;
+    int iLod = pThis->iPrefetchLod;
+    pThis->bPrefetchPending = 0;
+    if (dLeft == dDoneLeft && dRight == dDoneRight && iLod == iDoneLod) continue;
+    dDoneLeft = dLeft;
+    dDoneRight = dRight;
+    iDoneLod = iLod;
+    pthread_mutex_unlock(&pThis->prefetchLock);
 
-  double dSamplesPerPixel = (dRightmostPixelSamplePos - dLeftmostPixelSamplePos) / (double)iWidth;
+    // The view itself was just read. Its neighbours, most likely first.
+    double dSpan = dRight - dLeft, dCenter = (dLeft + dRight) * 0.5;
+    prefetchRange(pThis, dRight, dRight + dSpan, iLod);
+    prefetchRange(pThis, dLeft - dSpan, dLeft, iLod);
+    prefetchRange(pThis, dLeft - dSpan * 0.5, dRight + dSpan * 0.5, iLod + 1);
+    if (iLod > 0) prefetchRange(pThis, dCenter - dSpan * 0.25, dCenter + dSpan * 0.25, iLod - 1);
 
-  float fUnitsPerPixel = (fTopmostValue - fBottommostValue) / (float)iHeight;
-  float fZeroAtYPixel = (float)iHeight * fTopmostValue / (fTopmostValue - fBottommostValue);
+    pthread_mutex_lock(&pThis->prefetchLock);
+  }
+  pthread_mutex_unlock(&pThis->prefetchLock);
+  return NULL;
+}
 
-  int x,y,i;
-  float fLOD = (float)(log(dSamplesPerPixel) / log(2.0) - 0.0);
-  if (fLOD<0.0f) fLOD=0.0f;
-  int iLOD = (int)fLOD;
-  float fFracLod = fLOD - iLOD;
-  float fLodScale = (1.0f/(1<<iLOD));
+// Pass a rendered view to the prefetch thread. Never waits, a view the thread misses is followed by another.
+static void hintView(SSG *pThis, double dLeft, double dRight, int iLod) {
+  if (!__atomic_load_n(&pThis->bPrefetchThread, __ATOMIC_RELAXED)) return;
+  if (pthread_mutex_trylock(&pThis->prefetchLock) != 0) return;
+  pThis->dPrefetchLeft = dLeft;
+  pThis->dPrefetchRight = dRight;
+  pThis->iPrefetchLod = iLod;
+  pThis->bPrefetchPending = 1;
+  pthread_cond_signal(&pThis->prefetchWake);
+  pthread_mutex_unlock(&pThis->prefetchLock);
+}
 
-  float fPixelsPerUnit = 1.0f / fUnitsPerPixel;
-  double dSamplePos = dLeftmostPixelSamplePos;
+static void stopPrefetchThread(SSG *pThis) {
+  pthread_mutex_lock(&pThis->prefetchLock);
+  int bRunning = pThis->bPrefetchThread;
+  pThis->bPrefetchStop = 1;
+  pthread_cond_signal(&pThis->prefetchWake);
+  pthread_mutex_unlock(&pThis->prefetchLock);
+  if (bRunning) pthread_join(pThis->prefetchThread, NULL);
+  __atomic_store_n(&pThis->bPrefetchThread, 0, __ATOMIC_RELAXED);
+}
 
-  for (x=0; x<iWidth; x++) {
-    double dBaseLodSamplePos = dSamplePos * fLodScale;
-    double dNextLodSamplePos = dBaseLodSamplePos * 0.5 - 0.5;
-
-    int iBaseLodSamplePos = (int)dBaseLodSamplePos;
-    int iNextLodSamplePos = (int)dNextLodSamplePos;
-    float fBaseLodSamplePosFrac = (float)(dBaseLodSamplePos - iBaseLodSamplePos);
-    float fNextLodSamplePosFrac = (float)(dNextLodSamplePos - iNextLodSamplePos);
-
-    if (dSamplesPerPixel < 1.0) {
-      // TODO: Make it filtered? Quite jittery now...
-      float v1, v2;
-      getSample(pThis, (int64_t)(dSamplePos - dSamplesPerPixel), 0, &v1, &v1); v1 = fZeroAtYPixel - fPixelsPerUnit * v1;
-      getSample(pThis, (int64_t) dSamplePos                    , 0, &v2, &v2); v2 = fZeroAtYPixel - fPixelsPerUnit * v2;
-      int miny = (int)MIN(v1,v2);
-      int maxy = (int)MAX(v1,v2);
-      for (y=0; y<iHeight; y++) {
-        pDstBuffer[y*iWidth + x] = (uint8_t)((miny<=y && y<=maxy) ? 255 : 0);
-      }
-    } else {
-      float afBaseMin[3], afBaseMax[3];
-      float afNextMin[3], afNextMax[3];
-      for (i = 0; i < 3; i++) {
-        getSample(pThis, iBaseLodSamplePos + i, iLOD    , &afBaseMin[i], &afBaseMax[i]);
-        getSample(pThis, iNextLodSamplePos + i, iLOD + 1, &afNextMin[i], &afNextMax[i]);
-        afBaseMin[i] = fZeroAtYPixel - fPixelsPerUnit * afBaseMin[i];
-        afBaseMax[i] = fZeroAtYPixel - fPixelsPerUnit * afBaseMax[i];
-        afNextMin[i] = fZeroAtYPixel - fPixelsPerUnit * afNextMin[i];
-        afNextMax[i] = fZeroAtYPixel - fPixelsPerUnit * afNextMax[i];
-      }
-      for (y = 0; y < iHeight; y++) {
-        int v02 = ((((int) MIN(afBaseMax[0],afBaseMin[1])) <= y) && (y <= ((int) MAX(afBaseMin[0],afBaseMax[1])))) ? 1 : 0;
-        int v03 = ((((int) MIN(afBaseMax[1],afBaseMin[2])) <= y) && (y <= ((int) MAX(afBaseMin[1],afBaseMax[2])))) ? 1 : 0;
-        int v12 = ((((int) MIN(afNextMax[0],afNextMin[1])) <= y) && (y <= ((int) MAX(afNextMin[0],afNextMax[1])))) ? 1 : 0;
-        int v13 = ((((int) MIN(afNextMax[1],afNextMin[2])) <= y) && (y <= ((int) MAX(afNextMin[1],afNextMax[2])))) ? 1 : 0;
+// Commits what was added or rewritten since the last commit, the only call here that waits for the disk
+static void closeContainer(SSG *pThis) {
+  int i;
+  stopPrefetchThread(pThis);
+  stopFlushThread(pThis);
+  stopColdThread(pThis);
+  if (pThis->pHeader != NULL && pThis->bWritable && commitDue(pThis)) {
+    if (commitEdits(pThis) != 0) printf("%d: %s\n", errno, strerror(errno));
+  }
+  for (i = 0; i < pThis->iWindows; i++) {
+    munmap(pThis->aWindows[i].pBase, pThis->aWindows[i].iSize);
+  }
+  if (pThis->pHeader != NULL && pThis->bWritable && pThis->iFileCapacity > pThis->iFileSize) {
+    // Give back the space allocated ahead
+    if (ftruncate(pThis->fd, pThis->iFileSize) != 0) printf("%d: %s\n", errno, strerror(errno));
+  }
+  if (pThis->fd >= 0) close(pThis->fd);
+  for (i = 0; i < COLD_CACHE_BLOCKS; i++) free(pThis->aColdCache[i].pFrames);
+  pthread_cond_destroy(&pThis->coldWake);
+  pthread_mutex_destroy(&pThis->coldLock);
+  pthread_mutex_destroy(&pThis->allocLock);
+  pthread_cond_destroy(&pThis->flushWake);
+  pthread_mutex_destroy(&pThis->flushLock);
+  pthread_mutex_destroy(&pThis->commitLock);
+  pthread_cond_destroy(&pThis->prefetchWake);
+  pthread_mutex_destroy(&pThis->prefetchLock);
+  free(pThis->pEncodeBuffer);
+  free(pThis->pLodBuffers);
+  free(pThis->pMomentBuffers);
+  free(pThis);
+}
 
-        int iv0 = linear(v02, v03, fBaseLodSamplePosFrac);
-        int iv1 = linear(v12, v13, fNextLodSamplePosFrac);
+// Map the extents of a buffer listed in the directory, and check them against the file
+static int mapBuffer(SSG *pThis, Buffer *pB, const ContainerLevel *pDir) {
+  int i;
+  if (pDir->iExtents > MAX_EXTENTS) return -1;
+  if (pDir->iExtentTable != 0) {
+    if (pDir->iExtentTable < sizeof(ContainerHeader) || pDir->iExtentTable + EXTENT_TABLE_SIZE > pThis->iFileSize) return -1;
+    pB->piExtentOffset = mapFileRange(pThis, pDir->iExtentTable, EXTENT_TABLE_SIZE);
+    if (pB->piExtentOffset == NULL) return -1;
+  } else if (pDir->iExtents != 0) {
+    return -1;
+  }
+  for (i = 0; i < (int)pDir->iExtents; i++) {
+    uint64_t iBytes = (uint64_t)pB->iEntrySize << (EXTENT_BASE_LOG2 + i);
+    // An extent added after the last commit whose table entry didn't reach the disk, its entries weren't committed
+    if (pB->piExtentOffset[i] < CONTAINER_HEADER_SIZE) break;
+    if (pB->piExtentOffset[i] + iBytes > pThis->iFileSize) return -1;
+    pB->apExtent[i] = mapFileRange(pThis, pB->piExtentOffset[i], iBytes);
+    if (pB->apExtent[i] == NULL) return -1;
+  }
+  pB->iExtents = i;
+  setAllocated(pB);
+  if (pDir->iLength > pB->iAllocated) return -1;
+  pB->iWritePointer = pDir->iLength;
+  return 0;
+}
 
-        uint8_t iv = (uint8_t)(iv0 + (iv1 - iv0) * fFracLod); // TODO: Bad with float->int->float->int.
-        iv = pThis->aiGammaxlat[iv];
+// LOD levels the level directory has room for at the fan-out of the graph
+static int directoryLevels(SSG *pThis) {
+  return MAX_MIP_LOD / pThis->iFanoutLog2;
+}
+// Size the rings for keeping iRetain raw samples, 0 for all. Needs the entry sizes, returns the bytes of the rings.
+// Levels whose entries cover more than the kept samples are left out, coarser views combine entries of the top one.
+static uint64_t setupRings(SSG *pThis, uint64_t iRetain) {
+  uint64_t iBytes = 0;
+  int iLevel;
 
-        pDstBuffer[y * iWidth + x] = iv;
-      }
+  pThis->iLevels = directoryLevels(pThis);
+  while (iRetain != 0 && pThis->iLevels > 1 && ((uint64_t)1 << (pThis->iLevels * pThis->iFanoutLog2)) > iRetain) {
+    pThis->iLevels--;
+  }
+  pThis->iRetainSamples = (iRetain != 0) ? iRetain : UINT64_MAX;
+  pThis->iRingSlack = (iRetain != 0) ? MAX(INGEST_CHUNK, iRetain / 8) : UINT64_MAX;
+  for (iLevel = 0; iLevel <= pThis->iLevels; iLevel++) {
+    Buffer *pB = levelBuffer(pThis, iLevel);
+    pB->iRing = 0;
+    if (iRetain != 0) {
+      pB->iRing = ringEntries(levelLength(pThis, iLevel, iRetain + pThis->iRingSlack));
+      if (iLevel == 0) pB->iRing = ringEntries(iRetain + pThis->iRingSlack + (1 << TIME_BLOCK_LOG2));
+      iBytes += pB->iRing * pB->iEntrySize;
+    }
+  }
+  pThis->times.iRing = 0;
+  pThis->timeIndex.iRing = 0;
+  if (iRetain != 0 && pThis->bTimestamps) {
+    pThis->times.iRing = pThis->samples.iRing;
+    pThis->timeIndex.iRing = ringEntries(timeBlocks(iRetain + pThis->iRingSlack));
+    iBytes += pThis->times.iRing * pThis->times.iEntrySize + pThis->timeIndex.iRing * pThis->timeIndex.iEntrySize;
+  }
+  for (iLevel = pThis->iMomentLog2 / pThis->iFanoutLog2; pThis->iMomentLog2 != 0 && iLevel <= pThis->iLevels; iLevel++) {
+    Buffer *pB = momentBuffer(pThis, iLevel);
+    pB->iRing = 0;
+    if (iRetain != 0) {
+      pB->iRing = ringEntries(levelLength(pThis, iLevel, iRetain + pThis->iRingSlack));
+      iBytes += pB->iRing * pB->iEntrySize;
     }
-    dSamplePos += dSamplesPerPixel;
   }
+  return iBytes;
+}
+// Most raw samples whose rings fit in iBytes, 0 if not even one does
+static uint64_t samplesForBytes(SSG *pThis, uint64_t iBytes) {
+  uint64_t iLo = 0, iHi = iBytes;
+  if (setupRings(pThis, 1) > iBytes) return 0;
+  while (iLo < iHi) {
+    uint64_t iMid = iHi - (iHi - iLo) / 2;
+    if (setupRings(pThis, iMid) <= iBytes) iLo = iMid;
+    else iHi = iMid - 1;
+  }
+  return iLo;
+}
+
+static SSG *openContainer(const char *pcFilename, int bWritable, const SSG_Options *pOptions) {
+  SSG *pThis = calloc(sizeof(SSG), 1);
+  ContainerHeader *pHeader;
+  uint64_t iRetainBytes = 0;
+  int i, iLevel;
+
+  if (pThis == NULL) return NULL;
+  pthread_mutex_init(&pThis->allocLock, NULL);
+  pthread_mutex_init(&pThis->coldLock, NULL);
+  pthread_cond_init(&pThis->coldWake, NULL);
+  pthread_mutex_init(&pThis->commitLock, NULL);
+  pthread_mutex_init(&pThis->flushLock, NULL);
+  pthread_cond_init(&pThis->flushWake, NULL);
+  pthread_mutex_init(&pThis->prefetchLock, NULL);
+  pthread_cond_init(&pThis->prefetchWake, NULL);
+  for (i = 0; i < COLD_CACHE_BLOCKS; i++) pThis->aColdCache[i].iBlock = -1;
+  pThis->bWritable = bWritable;
+  for (i=0; i<256; i++) {
+    pThis->aiGammaxlat[i] = (uint8_t)sqrt(256*i);
+  }
+
+  pThis->fd = open(pcFilename, bWritable ? (O_RDWR | O_CREAT) : O_RDONLY, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+  if (pThis->fd < 0) goto FAIL;
+  pThis->iFileSize = lseek(pThis->fd, 0, SEEK_END);
+  pThis->iFileCapacity = pThis->iFileSize;
+
+  if (pThis->iFileSize == 0) {
+    // All new file, write an empty directory
+    if (!bWritable || ftruncate(pThis->fd, CONTAINER_HEADER_SIZE) != 0) goto FAIL;
+    pThis->iFileSize = CONTAINER_HEADER_SIZE;
+    pThis->iFileCapacity = CONTAINER_HEADER_SIZE;
+    pHeader = mapFileRange(pThis, 0, CONTAINER_HEADER_SIZE);
+    if (pHeader == NULL) goto FAIL;
+    memcpy(pHeader->acMagic, CONTAINER_MAGIC, sizeof(pHeader->acMagic));
+    pHeader->iVersion = CONTAINER_VERSION;
+    pHeader->iHeaderSize = CONTAINER_HEADER_SIZE;
+    pHeader->iLevels = CONTAINER_LEVELS;
+    pHeader->iExtentBaseLog2 = EXTENT_BASE_LOG2;
+    pHeader->iDataEnd = CONTAINER_HEADER_SIZE;
+    pHeader->iTableNext = sizeof(ContainerHeader);
+    pHeader->iTableEnd = CONTAINER_HEADER_SIZE;
+    pHeader->iFanoutLog2 = 1;
+    pHeader->iChannels = 1;
+    pHeader->dScale = 1.0;
+    if (pOptions != NULL && pOptions->iChannels != 0) {
+      if (pOptions->iChannels < 1 || pOptions->iChannels > SSG_MAX_CHANNELS) goto FAIL;
+      pHeader->iChannels = pOptions->iChannels;
+    }
+    if (pOptions != NULL) {
+      if (sampleSize(pOptions->iSampleType) == 0 || pOptions->dScale < 0.0) goto FAIL;
+      pHeader->iSampleType = pOptions->iSampleType;
+      if (pOptions->dScale != 0.0) pHeader->dScale = pOptions->dScale;
+      pHeader->dOffset = pOptions->dOffset;
+      if (pOptions->bTimestamps) pHeader->iFlags |= CONTAINER_FLAG_TIMESTAMPS;
+      if (pOptions->bDensity) pHeader->iFlags |= CONTAINER_FLAG_MOMENT_LEVELS;
+      pHeader->iRetainSamples = pOptions->iRetainSamples;
+      iRetainBytes = pOptions->iRetainBytes;
+    }
+    if (pOptions != NULL && pOptions->iFanout != 0) {
+      switch (pOptions->iFanout) {
+        case 2:  pHeader->iFanoutLog2 = 1; break;
+        case 4:  pHeader->iFanoutLog2 = 2; break;
+        case 8:  pHeader->iFanoutLog2 = 3; break;
+        case 16: pHeader->iFanoutLog2 = 4; break;
+        default: goto FAIL;
+      }
+    }
+  } else {
+    if (pThis->iFileSize < CONTAINER_HEADER_SIZE) goto FAIL;
+    pHeader = mapFileRange(pThis, 0, pThis->iFileSize);
+    if (pHeader == NULL) goto FAIL;
+  }
+  pThis->pHeader = pHeader;
+
+  if (memcmp(pHeader->acMagic, CONTAINER_MAGIC, sizeof(pHeader->acMagic)) != 0 || pHeader->iVersion != CONTAINER_VERSION ||
+      pHeader->iLevels != CONTAINER_LEVELS || pHeader->iHeaderSize != CONTAINER_HEADER_SIZE ||
+      pHeader->iExtentBaseLog2 != EXTENT_BASE_LOG2 || pHeader->iFanoutLog2 < 1 || pHeader->iFanoutLog2 > 4 ||
+      pHeader->iChannels < 1 || pHeader->iChannels > SSG_MAX_CHANNELS || sampleSize(pHeader->iSampleType) == 0 ||
+      !(pHeader->dScale > 0.0) || pHeader->iDataEnd < pHeader->iHeaderSize || pHeader->iTableNext > pHeader->iTableEnd ||
+      pHeader->iTableEnd > pHeader->iDataEnd) {
+    printf("%s: not a version %d graph container\n", pcFilename, CONTAINER_VERSION);
+    goto FAIL;
+  }
+  // The file is longer when a writer allocated ahead and did not get to trim
+  if (pHeader->iDataEnd > pThis->iFileSize) {
+    // The directory reached the disk before the file size did. Committed data lies within the durable size, the
+    // extents past it are filled again.
+    if (bWritable && growFile(pThis, pHeader->iDataEnd) != 0) goto FAIL;
+  }
+  pThis->iFileSize = pHeader->iDataEnd;
+  pThis->iFanoutLog2 = pHeader->iFanoutLog2;
+  // Up to 2^MAX_MIP_LOD samples per entry whatever the fan-out. Coarser views then combine more entries of the top
+  // level, see getSamples. Retention may keep fewer, see setupRings.
+  pThis->iLevels = directoryLevels(pThis);
+  pThis->pLodBuffers = calloc(pThis->iLevels, sizeof(Buffer));
+  if (pThis->pLodBuffers == NULL) goto FAIL;
+  pThis->iChannels = pHeader->iChannels;
+  pThis->iSampleType = pHeader->iSampleType;
+  pThis->dScale = pHeader->dScale;
+  pThis->dOffset = pHeader->dOffset;
+  pThis->fScale = (float)pThis->dScale;
+  pThis->fOffset = (float)pThis->dOffset;
+  pThis->bPassThrough = pThis->iSampleType == SSG_SAMPLE_FLOAT && pThis->dScale == 1.0 && pThis->dOffset == 0.0;
+
+  pThis->bTimestamps = (pHeader->iFlags & CONTAINER_FLAG_TIMESTAMPS) != 0;
+  for (iLevel = 0; iLevel <= pThis->iLevels; iLevel++) {
+    Buffer *pB = levelBuffer(pThis, iLevel);
+    pB->iValues = (iLevel == 0) ? 1 : 2;
+    pB->iStride = pB->iValues * pThis->iChannels;
+    pB->iEntrySize = pB->iStride * sampleSize(pThis->iSampleType);
+  }
+  pThis->times.iEntrySize = sizeof(int64_t);
+  pThis->timeIndex.iEntrySize = sizeof(int64_t);
+  if (pHeader->iFlags & CONTAINER_FLAG_MOMENT_LEVELS) {
+    // The first stored level with entries of at least 2^DENSITY_BLOCK_LOG2 raw frames
+    pThis->iMomentLog2 = (DENSITY_BLOCK_LOG2 + pThis->iFanoutLog2 - 1) / pThis->iFanoutLog2 * pThis->iFanoutLog2;
+    pThis->pMomentBuffers = calloc(pThis->iLevels + 1, sizeof(Buffer));
+    if (pThis->pMomentBuffers == NULL) goto FAIL;
+    for (iLevel = pThis->iMomentLog2 / pThis->iFanoutLog2; iLevel <= pThis->iLevels; iLevel++) {
+      Buffer *pB = momentBuffer(pThis, iLevel);
+      pB->iValues = 2;
+      pB->iStride = 2 * pThis->iChannels;
+      pB->iEntrySize = pB->iStride * sizeof(double);
+    }
+  }
+  if (iRetainBytes != 0) {
+    uint64_t iRetain = samplesForBytes(pThis, iRetainBytes);
+    if (iRetain == 0) goto FAIL;
+    if (pHeader->iRetainSamples == 0 || pHeader->iRetainSamples > iRetain) pHeader->iRetainSamples = iRetain;
+  }
+  // Cold storage and retention don't mix, SSG_SetColdStorage refuses
+  if (pHeader->iRetainSamples != 0 && pHeader->iColdBlocks != 0) goto FAIL;
+  setupRings(pThis, pHeader->iRetainSamples);
+  if (pThis->iMomentLog2 > pThis->iLevels * pThis->iFanoutLog2) pThis->iMomentLog2 = 0; // retention kept too few levels
+
+  for (iLevel = 0; iLevel <= pThis->iLevels; iLevel++) {
+    if (mapBuffer(pThis, levelBuffer(pThis, iLevel), &pHeader->aLevels[iLevel]) != 0) goto FAIL;
+  }
+  pThis->coldIndex.iEntrySize = sizeof(uint64_t);
+  pThis->coldData.iEntrySize = 1;
+  if (mapBuffer(pThis, &pThis->coldIndex, &pHeader->coldIndex) != 0 || mapBuffer(pThis, &pThis->coldData, &pHeader->coldData) != 0 ||
+      pHeader->iColdBlocks > pThis->coldIndex.iWritePointer || (pHeader->iColdBlocks << COLD_BLOCK_LOG2) > pThis->samples.iWritePointer) {
+    goto FAIL;
+  }
+  pThis->iColdBlocks = pHeader->iColdBlocks;
+  if (mapBuffer(pThis, &pThis->times, &pHeader->times) != 0 || mapBuffer(pThis, &pThis->timeIndex, &pHeader->timeIndex) != 0) {
+    goto FAIL;
+  }
+  if (pThis->bTimestamps) {
+    // Committed with the raw length, see commitContainer
+    if (pThis->times.iWritePointer != pThis->samples.iWritePointer ||
+        pThis->timeIndex.iWritePointer != timeBlocks(pThis->samples.iWritePointer)) {
+      goto FAIL;
+    }
+  }
+  for (iLevel = pThis->iMomentLog2 / pThis->iFanoutLog2; pThis->iMomentLog2 != 0 && iLevel <= pThis->iLevels; iLevel++) {
+    Buffer *pB = momentBuffer(pThis, iLevel);
+    if (mapBuffer(pThis, pB, &pHeader->aMomentLevels[iLevel]) != 0) goto FAIL;
+    // Like the levels, follows from the raw length
+    pB->iWritePointer = levelLength(pThis, iLevel, pThis->samples.iWritePointer);
+    if (pB->iWritePointer > pB->iAllocated) goto FAIL;
+  }
+  // The header pages of a commit may reach the disk in any order. The raw length decides, the level entries up to
+  // it were durable before it was written.
+  for (iLevel = 1; iLevel <= pThis->iLevels; iLevel++) {
+    Buffer *pB = levelBuffer(pThis, iLevel);
+    pB->iWritePointer = levelLength(pThis, iLevel, pThis->samples.iWritePointer);
+    if (pB->iWritePointer > pB->iAllocated) goto FAIL;
+  }
+  if (bWritable && pHeader->iRetainSamples != 0) {
+    // Allocate the rings up front, the file then has its final size. It is sparse until the rings are filled.
+    for (iLevel = 0; iLevel <= pThis->iLevels; iLevel++) {
+      if (reserveEntries(pThis, iLevel, UINT64_MAX) != 0) goto FAIL;
+    }
+    if (pThis->bTimestamps && (reserveBuffer(pThis, &pThis->times, &pHeader->times, UINT64_MAX) != 0 ||
+                               reserveBuffer(pThis, &pThis->timeIndex, &pHeader->timeIndex, UINT64_MAX) != 0)) {
+      goto FAIL;
+    }
+    for (iLevel = pThis->iMomentLog2 / pThis->iFanoutLog2; pThis->iMomentLog2 != 0 && iLevel <= pThis->iLevels; iLevel++) {
+      if (reserveMoments(pThis, iLevel, UINT64_MAX) != 0) goto FAIL;
+    }
+  }
+  pThis->iCommittedLength = pThis->samples.iWritePointer;
+  publishLength(pThis);
+  pThis->iOpenLength = pThis->samples.iWritePointer;
+  return pThis;
+
+FAIL:
+  pThis->pHeader = NULL;
+  closeContainer(pThis);
+  return NULL;
+}
+
+/*
+ * Worker pool
+ *
+ * Runs a batch of numbered tasks on a set of threads. The submitting thread takes tasks as well, and batches from
+ * different submitters are serialized, so one pool can be shared between graphs rendered from several threads.
+ */
+
+typedef void (*TaskFunc)(void *pArg, int iTask);
+
+struct SSG_WorkerPool_private {
+  pthread_mutex_t submitLock; // held for a whole batch
+  pthread_mutex_t lock;       // protects the fields below
+  pthread_cond_t wake;
+  pthread_cond_t done;
+  TaskFunc pfnTask;
+  void *pArg;
+  int iTasks;
+  int iNextTask;
+  int iUnfinished;
+  int bQuit;
+  int iThreads;
+  pthread_t *aThreads;
+};
+
+// Take and run tasks until the batch is handed out. Called with the lock held, returns with it held.
+static void runPendingTasks(SSG_WorkerPool *pPool) {
+  while (pPool->iNextTask < pPool->iTasks) {
+    int iTask = pPool->iNextTask++;
+    pthread_mutex_unlock(&pPool->lock);
+    pPool->pfnTask(pPool->pArg, iTask);
+    pthread_mutex_lock(&pPool->lock);
+    if (--pPool->iUnfinished == 0) pthread_cond_broadcast(&pPool->done);
+  }
+}
+
+static void *poolWorker(void *pArg) {
+  SSG_WorkerPool *pPool = pArg;
+  pthread_mutex_lock(&pPool->lock);
+  while (!pPool->bQuit) {
+    runPendingTasks(pPool);
+    if (!pPool->bQuit) pthread_cond_wait(&pPool->wake, &pPool->lock);
+  }
+  pthread_mutex_unlock(&pPool->lock);
+  return NULL;
+}
+
+static void runTasks(SSG_WorkerPool *pPool, TaskFunc pfnTask, void *pArg, int iTasks) {
+  pthread_mutex_lock(&pPool->submitLock);
+  pthread_mutex_lock(&pPool->lock);
+  pPool->pfnTask = pfnTask;
+  pPool->pArg = pArg;
+  pPool->iTasks = iTasks;
+  pPool->iNextTask = 0;
+  pPool->iUnfinished = iTasks;
+  pthread_cond_broadcast(&pPool->wake);
+  runPendingTasks(pPool);
+  while (pPool->iUnfinished > 0) pthread_cond_wait(&pPool->done, &pPool->lock);
+  pthread_mutex_unlock(&pPool->lock);
+  pthread_mutex_unlock(&pPool->submitLock);
+}
+
+SSG_WorkerPool *SSG_WorkerPoolNew(int iThreads) {
+  SSG_WorkerPool *pPool = calloc(sizeof(SSG_WorkerPool), 1);
+  int i;
+  if (pPool == NULL) return NULL;
+  if (iThreads <= 0) iThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  pthread_mutex_init(&pPool->submitLock, NULL);
+  pthread_mutex_init(&pPool->lock, NULL);
+  pthread_cond_init(&pPool->wake, NULL);
+  pthread_cond_init(&pPool->done, NULL);
+  // The submitting thread is one of the workers
+  pPool->aThreads = calloc(sizeof(pthread_t), MAX(iThreads-1, 1));
+  for (i = 0; i < iThreads-1; i++) {
+    if (pthread_create(&pPool->aThreads[i], NULL, poolWorker, pPool) != 0) break;
+  }
+  pPool->iThreads = i;
+  return pPool;
+}
+
+void SSG_WorkerPoolTeardown(SSG_WorkerPool *pPool) {
+  int i;
+  pthread_mutex_lock(&pPool->lock);
+  pPool->bQuit = 1;
+  pthread_cond_broadcast(&pPool->wake);
+  pthread_mutex_unlock(&pPool->lock);
+  for (i = 0; i < pPool->iThreads; i++) {
+    pthread_join(pPool->aThreads[i], NULL);
+  }
+  pthread_cond_destroy(&pPool->done);
+  pthread_cond_destroy(&pPool->wake);
+  pthread_mutex_destroy(&pPool->lock);
+  pthread_mutex_destroy(&pPool->submitLock);
+  free(pPool->aThreads);
+  free(pPool);
+}
+
+SSG *SSG_New(char *pcBasefilename, int bWritable) {
+  return SSG_NewEx(pcBasefilename, bWritable, NULL);
+}
+
+SSG *SSG_NewEx(char *pcBasefilename, int bWritable, const SSG_Options *pOptions) {
+  char acFilename[1024];
+  char acLegacyFilename[1024];
+  snprintf(acFilename, sizeof(acFilename), "%s.ssg", pcBasefilename);
+  snprintf(acLegacyFilename, sizeof(acLegacyFilename), "%s_rawsamples.bin", pcBasefilename);
+  if (access(acFilename, F_OK) != 0 && access(acLegacyFilename, F_OK) == 0) {
+    // Converting writes a new file next to the user's data, a read-only open must not
+    if (!bWritable) {
+      printf("%s: older layout, open writable once to convert it\n", acLegacyFilename);
+      return NULL;
+    }
+    if (SSG_ConvertMultiFile(pcBasefilename, pOptions) != 0) return NULL;
+  }
+  return openContainer(acFilename, bWritable, pOptions);
+}
+
+void SSG_Teardown(SSG* pThis) {
+  closeContainer(pThis);
+}
+
+// Min and max of iCount entries of the top level from iFirst, per channel. Only for views coarser than the top
+// level, with retention or a fan-out that doesn't divide MAX_MIP_LOD, and those entries may span extents.
+__attribute__((noinline))
+static void getTopSamples(SSG *pThis, uint64_t iFirst, uint64_t iCount, float *pfOutMin, float *pfOutMax, int iChannels) {
+  Buffer *pB = levelBuffer(pThis, pThis->iLevels);
+  uint64_t i;
+  int c;
+  for (c = 0; c < iChannels; c++) {
+    pfOutMin[c] = INFINITY;
+    pfOutMax[c] = -INFINITY;
+  }
+  while (iCount > 0) {
+    uint64_t iRun = MIN(iCount, bufferRun(pB, iFirst));
+    const void *pEntry = entryPtr(pB, iFirst);
+    for (i = 0; i < iRun; i++) {
+      for (c = 0; c < iChannels; c++) {
+        pfOutMin[c] = MIN(pfOutMin[c], loadFloat(pEntry, i*pB->iStride + 2*c, pThis->iSampleType));
+        pfOutMax[c] = MAX(pfOutMax[c], loadFloat(pEntry, i*pB->iStride + 2*c + 1, pThis->iSampleType));
+      }
+    }
+    iFirst += iRun;
+    iCount -= iRun;
+  }
+}
+// iLevel counts 2:1 steps whatever the fan-out. Levels between the stored ones are made from a few stored entries.
+// Only the first iLength raw samples and the level entries made from them are read, raw samples below iColdLength
+// from cold storage. Fills in min and max of iChannels channels. Inlined, so the single channel case and each type
+// get their own code.
+__attribute__((always_inline))
+static inline void getSamples(SSG* pThis, uint64_t iLength, uint64_t iColdLength, int64_t iSamplePos, int iLevel, float* pfOutMin, float* pfOutMax, int iChannels, int iType) {
+  int iStored = MIN(iLevel / pThis->iFanoutLog2, pThis->iLevels);
+  int iSteps = iLevel - iStored * pThis->iFanoutLog2;
+  Buffer *pB = levelBuffer(pThis, iStored);
+  uint64_t iEntries = levelLength(pThis, iStored, iLength);
+  uint64_t iKept = levelLength(pThis, iStored, retainedStart(pThis, iLength));
+  int c, i;
+
+  if (iLevel <= MAX_MIP_LOD && iSamplePos>=0 && ((uint64_t)iSamplePos << iSteps) < iEntries &&
+      ((uint64_t)(iSamplePos + 1) << iSteps) > iKept) {
+    uint64_t iFirst = MAX((uint64_t)iSamplePos << iSteps, iKept);
+    if (iSteps >= pThis->iFanoutLog2) {
+      getTopSamples(pThis, iFirst, MIN((uint64_t)(iSamplePos + 1) << iSteps, iEntries) - iFirst, pfOutMin, pfOutMax, iChannels);
+      return;
+    }
+    int iCount = (int)(MIN((uint64_t)(iSamplePos + 1) << iSteps, iEntries) - iFirst);
+    if (iStored == 0 && iFirst < iColdLength) {
+      getColdSamples(pThis, iFirst, iCount, pfOutMin, pfOutMax, iChannels);
+      return;
+    }
+    const void *pEntry = entryPtr(pB, iFirst); // within one extent, as extents hold whole groups
+    int iValues = pB->iValues;
+    for (c = 0; c < iChannels; c++) {
+      float fMin = loadFloat(pEntry, c*iValues, iType);
+      float fMax = loadFloat(pEntry, c*iValues + iValues-1, iType);
+      for (i = 1; i < iCount; i++) {
+        fMin = MIN(fMin, loadFloat(pEntry, i*pB->iStride + c*iValues, iType));
+        fMax = MAX(fMax, loadFloat(pEntry, i*pB->iStride + c*iValues + iValues-1, iType));
+      }
+      pfOutMin[c] = fMin;
+      pfOutMax[c] = fMax;
+    }
+  } else {
+    for (c = 0; c < iChannels; c++) {
+      pfOutMin[c] = 0.0f;
+      pfOutMax[c] = 0.0f;
+    }
+  }
+}
+// Min/max of each group of iFanout entries, per channel. Inlined with constant arguments, so the common cases
+// get their own loops.
+__attribute__((always_inline))
+static inline void reduceGroups(const void *pSrc, int iSrcValues, void *pDst, uint64_t iCount, int iFanout, int iChannels, int iType) {
+  int iSrcStride = iSrcValues * iChannels;
+  uint64_t i;
+  int j, c;
+  for (i=0; i<iCount; i++) {
+    for (c=0; c<iChannels; c++) {
+      uint64_t iGroup = i*iFanout*iSrcStride + c*iSrcValues;
+      SampleValue vMin = loadValue(pSrc, iGroup, iType);
+      SampleValue vMax = loadValue(pSrc, iGroup + iSrcValues-1, iType);
+      for (j=1; j<iFanout; j++) {
+        vMin = MIN(vMin, loadValue(pSrc, iGroup + j*iSrcStride, iType));
+        vMax = MAX(vMax, loadValue(pSrc, iGroup + j*iSrcStride + iSrcValues-1, iType));
+      }
+      storeValue(pDst, 2*(i*iChannels+c),   vMin, iType);
+      storeValue(pDst, 2*(i*iChannels+c)+1, vMax, iType);
+    }
+  }
+}
+__attribute__((always_inline))
+static inline void reduceBlockType(const void *pSrc, int iSrcValues, void *pDst, uint64_t iCount, int iFanoutLog2, int iChannels, int iType) {
+  if (iChannels > 1) {
+    switch (iFanoutLog2) {
+      case 1:  reduceGroups(pSrc, iSrcValues, pDst, iCount, 2, iChannels, iType);  break;
+      case 2:  reduceGroups(pSrc, iSrcValues, pDst, iCount, 4, iChannels, iType);  break;
+      case 3:  reduceGroups(pSrc, iSrcValues, pDst, iCount, 8, iChannels, iType);  break;
+      default: reduceGroups(pSrc, iSrcValues, pDst, iCount, 16, iChannels, iType); break;
+    }
+  } else if (iSrcValues == 1) {
+    switch (iFanoutLog2) {
+      case 1:  reduceGroups(pSrc, 1, pDst, iCount, 2, 1, iType);  break;
+      case 2:  reduceGroups(pSrc, 1, pDst, iCount, 4, 1, iType);  break;
+      case 3:  reduceGroups(pSrc, 1, pDst, iCount, 8, 1, iType);  break;
+      default: reduceGroups(pSrc, 1, pDst, iCount, 16, 1, iType); break;
+    }
+  } else {
+    switch (iFanoutLog2) {
+      case 1:  reduceGroups(pSrc, 2, pDst, iCount, 2, 1, iType);  break;
+      case 2:  reduceGroups(pSrc, 2, pDst, iCount, 4, 1, iType);  break;
+      case 3:  reduceGroups(pSrc, 2, pDst, iCount, 8, 1, iType);  break;
+      default: reduceGroups(pSrc, 2, pDst, iCount, 16, 1, iType); break;
+    }
+  }
+}
+static void reduceBlock(const void *pSrc, int iSrcValues, void *pDst, uint64_t iCount, int iFanoutLog2, int iChannels, int iType) {
+  switch (iType) {
+    case SSG_SAMPLE_INT8:   reduceBlockType(pSrc, iSrcValues, pDst, iCount, iFanoutLog2, iChannels, SSG_SAMPLE_INT8);   break;
+    case SSG_SAMPLE_INT16:  reduceBlockType(pSrc, iSrcValues, pDst, iCount, iFanoutLog2, iChannels, SSG_SAMPLE_INT16);  break;
+    case SSG_SAMPLE_HALF:   reduceBlockType(pSrc, iSrcValues, pDst, iCount, iFanoutLog2, iChannels, SSG_SAMPLE_HALF);   break;
+    case SSG_SAMPLE_DOUBLE: reduceBlockType(pSrc, iSrcValues, pDst, iCount, iFanoutLog2, iChannels, SSG_SAMPLE_DOUBLE); break;
+    default:                reduceBlockType(pSrc, iSrcValues, pDst, iCount, iFanoutLog2, iChannels, SSG_SAMPLE_FLOAT);  break;
+  }
+}
+// Level 1 entries [iStart, iEnd) from raw frames in cold storage, a block at a time
+static void reduceColdFrames(SSG* pThis, uint64_t iStart, uint64_t iEnd) {
+  Buffer *pDst = levelBuffer(pThis, 1);
+  int iFanoutLog2 = pThis->iFanoutLog2;
+  uint8_t *pFrames = malloc((size_t)pThis->samples.iEntrySize << COLD_BLOCK_LOG2);
+  if (pFrames == NULL) return;
+  while (iStart < iEnd) {
+    uint64_t iBlock = (iStart << iFanoutLog2) >> COLD_BLOCK_LOG2;
+    uint64_t iFirst = (iBlock << COLD_BLOCK_LOG2) >> iFanoutLog2;
+    uint64_t iCount = MIN(iEnd, ((iBlock + 1) << COLD_BLOCK_LOG2) >> iFanoutLog2) - iStart;
+    unpackColdBlock(pThis, iBlock, pFrames);
+    reduceBlock(pFrames + ((iStart - iFirst) << iFanoutLog2) * pThis->samples.iEntrySize, 1, entryPtr(pDst, iStart),
+                iCount, iFanoutLog2, pThis->iChannels, pThis->iSampleType);
+    iStart += iCount;
+  }
+  free(pFrames);
+}
+// Fill entries [iStart, iEnd) of level iLevel from the level below. Caller makes sure the space is allocated.
+static void reduceLevel(SSG* pThis, int iLevel, uint64_t iStart, uint64_t iEnd) {
+  Buffer *pSrc = levelBuffer(pThis, iLevel-1);
+  Buffer *pDst = levelBuffer(pThis, iLevel);
+  int iFanoutLog2 = pThis->iFanoutLog2;
+  if (iLevel == 1 && (iStart << iFanoutLog2) < coldLength(pThis)) {
+    uint64_t iCold = MIN(iEnd, coldLength(pThis) >> iFanoutLog2);
+    reduceColdFrames(pThis, iStart, iCold);
+    iStart = iCold;
+  }
+  while (iStart < iEnd) {
+    // Extents and rings hold whole groups, so a source group is always contiguous
+    uint64_t iCount = MIN(iEnd - iStart, MIN(bufferRun(pDst, iStart), bufferRun(pSrc, iStart << iFanoutLog2) >> iFanoutLog2));
+    reduceBlock(entryPtr(pSrc, iStart << iFanoutLog2), pSrc->iValues, entryPtr(pDst, iStart), iCount, iFanoutLog2,
+                pThis->iChannels, pThis->iSampleType);
+    iStart += iCount;
+  }
+}
+// Mean and M2, the sum of squared deviations from the mean, of each block of 2^iBlockLog2 frames, per channel, in
+// stored units. The second pass over a block finds it in cache. Four partial sums per block, so the adds don't wait
+// on each other. Inlined, so the single channel case and each type get their own loop.
+__attribute__((always_inline))
+static inline void blockMomentsChannels(const void *pFrames, double *pdDst, uint64_t iCount, int iBlockLog2, int iChannels, int iType) {
+  uint64_t i;
+  int j, k, c;
+  for (i = 0; i < iCount; i++) {
+    for (c = 0; c < iChannels; c++) {
+      double adSum[4] = { 0.0, 0.0, 0.0, 0.0 }, adSquares[4] = { 0.0, 0.0, 0.0, 0.0 };
+      uint64_t iFirst = (i << iBlockLog2) * iChannels + c;
+      for (j = 0; j < (1 << iBlockLog2); j += 4) {
+        for (k = 0; k < 4; k++) adSum[k] += loadValue(pFrames, iFirst + (uint64_t)(j + k) * iChannels, iType);
+      }
+      double dMean = ((adSum[0] + adSum[1]) + (adSum[2] + adSum[3])) / (1 << iBlockLog2);
+      for (j = 0; j < (1 << iBlockLog2); j += 4) {
+        for (k = 0; k < 4; k++) {
+          double d = loadValue(pFrames, iFirst + (uint64_t)(j + k) * iChannels, iType) - dMean;
+          adSquares[k] += d * d;
+        }
+      }
+      pdDst[2*(i*iChannels + c)] = dMean;
+      pdDst[2*(i*iChannels + c) + 1] = (adSquares[0] + adSquares[1]) + (adSquares[2] + adSquares[3]);
+    }
+  }
+}
+__attribute__((always_inline))
+static inline void blockMomentsType(const void *pFrames, double *pdDst, uint64_t iCount, int iBlockLog2, int iChannels, int iType) {
+  if (iChannels > 1) {
+    blockMomentsChannels(pFrames, pdDst, iCount, iBlockLog2, iChannels, iType);
+  } else {
+    blockMomentsChannels(pFrames, pdDst, iCount, iBlockLog2, 1, iType);
+  }
+}
+static void blockMoments(const void *pFrames, double *pdDst, uint64_t iCount, int iBlockLog2, int iChannels, int iType) {
+  switch (iType) {
+    case SSG_SAMPLE_INT8:   blockMomentsType(pFrames, pdDst, iCount, iBlockLog2, iChannels, SSG_SAMPLE_INT8);   break;
+    case SSG_SAMPLE_INT16:  blockMomentsType(pFrames, pdDst, iCount, iBlockLog2, iChannels, SSG_SAMPLE_INT16);  break;
+    case SSG_SAMPLE_HALF:   blockMomentsType(pFrames, pdDst, iCount, iBlockLog2, iChannels, SSG_SAMPLE_HALF);   break;
+    case SSG_SAMPLE_DOUBLE: blockMomentsType(pFrames, pdDst, iCount, iBlockLog2, iChannels, SSG_SAMPLE_DOUBLE); break;
+    default:                blockMomentsType(pFrames, pdDst, iCount, iBlockLog2, iChannels, SSG_SAMPLE_FLOAT);  break;
+  }
+}
+// Moment entries [iStart, iEnd) of the first level with moments, from the raw frames. Caller makes sure the space
+// is allocated.
+static void frameMoments(SSG* pThis, uint64_t iStart, uint64_t iEnd) {
+  Buffer *pSrc = &pThis->samples;
+  Buffer *pDst = momentBuffer(pThis, pThis->iMomentLog2 / pThis->iFanoutLog2);
+  int iLog2 = pThis->iMomentLog2;
+  uint8_t *pFrames = NULL;
+  while (iStart < iEnd) {
+    uint64_t iCount;
+    if ((iStart << iLog2) < coldLength(pThis)) {
+      // A cold block holds whole moment blocks
+      uint64_t iBlock = (iStart << iLog2) >> COLD_BLOCK_LOG2;
+      uint64_t iFirst = (iBlock << COLD_BLOCK_LOG2) >> iLog2;
+      iCount = MIN(MIN(iEnd, ((iBlock + 1) << COLD_BLOCK_LOG2) >> iLog2) - iStart, bufferRun(pDst, iStart));
+      if (pFrames == NULL && (pFrames = malloc((size_t)pSrc->iEntrySize << COLD_BLOCK_LOG2)) == NULL) return;
+      unpackColdBlock(pThis, iBlock, pFrames);
+      blockMoments(pFrames + ((iStart - iFirst) << iLog2) * pSrc->iEntrySize, entryPtr(pDst, iStart), iCount, iLog2,
+                   pThis->iChannels, pThis->iSampleType);
+    } else {
+      iCount = MIN(iEnd - iStart, MIN(bufferRun(pDst, iStart), bufferRun(pSrc, iStart << iLog2) >> iLog2));
+      blockMoments(entryPtr(pSrc, iStart << iLog2), entryPtr(pDst, iStart), iCount, iLog2, pThis->iChannels, pThis->iSampleType);
+    }
+    iStart += iCount;
+  }
+  free(pFrames);
+}
+// Moment entries [iStart, iEnd) of level iLevel from those of the level below. The parts have equal counts, so the
+// mean is the mean of their means, and M2 adds the spread of their means to their M2. Nothing is subtracted, so
+// nothing cancels however long the series or large its offset.
+static void reduceMoments(SSG* pThis, int iLevel, uint64_t iStart, uint64_t iEnd) {
+  Buffer *pSrc = momentBuffer(pThis, iLevel - 1);
+  Buffer *pDst = momentBuffer(pThis, iLevel);
+  int iFanoutLog2 = pThis->iFanoutLog2, iStride = pDst->iStride;
+  double dPartFrames = ldexp(1.0, (iLevel - 1) * iFanoutLog2);
+  uint64_t i;
+  int j, k;
+  while (iStart < iEnd) {
+    // Extents and rings hold whole groups, as for the levels
+    uint64_t iCount = MIN(iEnd - iStart, MIN(bufferRun(pDst, iStart), bufferRun(pSrc, iStart << iFanoutLog2) >> iFanoutLog2));
+    const double *pdParts = entryPtr(pSrc, iStart << iFanoutLog2);
+    double *pdDst = entryPtr(pDst, iStart);
+    for (i = 0; i < iCount; i++, pdParts += (size_t)iStride << iFanoutLog2, pdDst += iStride) {
+      for (j = 0; j < iStride; j += 2) {
+        double dMean = 0.0, dM2 = 0.0;
+        for (k = 0; k < (1 << iFanoutLog2); k++) dMean += pdParts[k*iStride + j];
+        dMean /= 1 << iFanoutLog2;
+        for (k = 0; k < (1 << iFanoutLog2); k++) {
+          double d = pdParts[k*iStride + j] - dMean;
+          dM2 += pdParts[k*iStride + j + 1] + dPartFrames * d * d;
+        }
+        pdDst[j] = dMean;
+        pdDst[j + 1] = dM2;
+      }
+    }
+    iStart += iCount;
+  }
+}
+// Moment entries for the raw frames appended since the last call, in every level they complete an entry of
+static int addMoments(SSG* pThis) {
+  int iLevel = pThis->iMomentLog2 / pThis->iFanoutLog2;
+  Buffer *pB = momentBuffer(pThis, iLevel);
+  uint64_t iEnd = levelLength(pThis, iLevel, pThis->samples.iWritePointer);
+  if (iEnd <= pB->iWritePointer) return 0;
+  if (reserveMoments(pThis, iLevel, iEnd) != 0) return -1;
+  frameMoments(pThis, pB->iWritePointer, iEnd);
+  pB->iWritePointer = iEnd;
+  for (iLevel++; iLevel <= pThis->iLevels; iLevel++) {
+    pB = momentBuffer(pThis, iLevel);
+    iEnd = momentBuffer(pThis, iLevel - 1)->iWritePointer >> pThis->iFanoutLog2;
+    if (iEnd <= pB->iWritePointer) break;
+    if (reserveMoments(pThis, iLevel, iEnd) != 0) return -1;
+    reduceMoments(pThis, iLevel, pB->iWritePointer, iEnd);
+    pB->iWritePointer = iEnd;
+  }
+  return 0;
+}
+// Moment entries over raw frames [iStart, iEnd) after those were rewritten, in each level the complete entries
+// covering them and nothing else
+static void repairMoments(SSG* pThis, uint64_t iStart, uint64_t iEnd) {
+  int iLevel;
+  for (iLevel = pThis->iMomentLog2 / pThis->iFanoutLog2; iLevel <= pThis->iLevels; iLevel++) {
+    int iShift = iLevel * pThis->iFanoutLog2;
+    uint64_t iTo = MIN(((iEnd - 1) >> iShift) + 1, momentBuffer(pThis, iLevel)->iWritePointer);
+    if ((iStart >> iShift) >= iTo) break;
+    if (iShift == pThis->iMomentLog2) {
+      frameMoments(pThis, iStart >> iShift, iTo);
+    } else {
+      reduceMoments(pThis, iLevel, iStart >> iShift, iTo);
+    }
+  }
+}
+// Append raw frames, already in the sample type, and their times if piTimes isn't NULL, without touching the levels
+static int appendRaw(SSG* pThis, const void *pFrames, const int64_t *piTimes, uint64_t iCount) {
+  Buffer *pSamples = &pThis->samples;
+  const uint8_t *pSrc = pFrames;
+
+  if (reserveEntries(pThis, 0, pSamples->iWritePointer + iCount) != 0) return -1;
+  if (piTimes != NULL && appendTimes(pThis, pSamples->iWritePointer, piTimes, iCount) != 0) return -1;
+  while (iCount > 0) {
+    uint64_t iRun = MIN(iCount, bufferRun(pSamples, pSamples->iWritePointer));
+    memcpy(entryPtr(pSamples, pSamples->iWritePointer), pSrc, iRun*pSamples->iEntrySize);
+    pSamples->iWritePointer += iRun;
+    pSrc += iRun*pSamples->iEntrySize;
+    iCount -= iRun;
+  }
+  return 0;
+}
+static void addSamples(SSG* pThis, const void *pFrames, const int64_t *piTimes, uint64_t iCount) {
+  int iLevel;
+
+  commitBeforeOverwrite(pThis, pThis->samples.iWritePointer + iCount);
+  if (appendRaw(pThis, pFrames, piTimes, iCount) != 0) return;
+
+  // Each level holds one entry per completed group in the level below. A group may straddle the previous block,
+  // its first part is then already in the source buffer.
+  for (iLevel=1; iLevel<=pThis->iLevels; iLevel++) {
+    Buffer *pDst = levelBuffer(pThis, iLevel);
+    uint64_t iStart = pDst->iWritePointer;
+    uint64_t iEnd = levelBuffer(pThis, iLevel-1)->iWritePointer >> pThis->iFanoutLog2;
+    if (iEnd <= iStart) break;
+
+    if (reserveEntries(pThis, iLevel, iEnd) != 0) return;
+    reduceLevel(pThis, iLevel, iStart, iEnd);
+    pDst->iWritePointer = iEnd;
+  }
+  if (pThis->iMomentLog2 != 0 && addMoments(pThis) != 0) return;
+  publishLength(pThis);
+  if (pThis->iFlushBytes != 0) requestFlush(pThis);
+}
+// Append one frame of physical values. Same result as addSamples, but only looks at the levels whose group it
+// completes. Inlined, so the single channel case and each type get their own code.
+__attribute__((always_inline))
+static inline void addFrameChannels(SSG* pThis, const float *pfValues, int iChannels, int iType) {
+  Buffer *pSamples = &pThis->samples;
+  uint64_t iEnd = pSamples->iWritePointer + 1;
+  void *pEntry;
+  int c, iLevel;
+
+  if (iEnd > pSamples->iAllocated && reserveEntries(pThis, 0, iEnd) != 0) return;
+  commitBeforeOverwrite(pThis, iEnd);
+  pEntry = entryPtr(pSamples, iEnd - 1);
+  if (iType == SSG_SAMPLE_FLOAT && pThis->bPassThrough) {
+    for (c = 0; c < iChannels; c++) ((float*)pEntry)[c] = pfValues[c];
+  } else {
+    for (c = 0; c < iChannels; c++) encodeValue(pThis, pEntry, c, pfValues[c], iType);
+  }
+  pSamples->iWritePointer = iEnd;
+  if (pThis->iMomentLog2 != 0 && (iEnd & ((1 << pThis->iMomentLog2) - 1)) == 0 && addMoments(pThis) != 0) return;
+
+  for (iLevel=1; iLevel<=pThis->iLevels; iLevel++) {
+    Buffer *pDst = levelBuffer(pThis, iLevel);
+    iEnd >>= pThis->iFanoutLog2;
+    if (iEnd <= pDst->iWritePointer) break;
+
+    if (iEnd > pDst->iAllocated && reserveEntries(pThis, iLevel, iEnd) != 0) return;
+    if (iEnd - pDst->iWritePointer == 1) {
+      Buffer *pSrc = levelBuffer(pThis, iLevel-1);
+      reduceGroups(entryPtr(pSrc, (iEnd-1) << pThis->iFanoutLog2), pSrc->iValues, entryPtr(pDst, iEnd-1), 1,
+                   1 << pThis->iFanoutLog2, iChannels, iType);
+    } else {
+      reduceLevel(pThis, iLevel, pDst->iWritePointer, iEnd);
+    }
+    pDst->iWritePointer = iEnd;
+  }
+  publishLength(pThis);
+  if (pThis->iFlushBytes != 0) requestFlush(pThis);
+}
+__attribute__((always_inline))
+static inline void addFrameType(SSG* pThis, const float *pfValues, int iType) {
+  if (pThis->iChannels == 1) {
+    addFrameChannels(pThis, pfValues, 1, iType);
+  } else {
+    addFrameChannels(pThis, pfValues, pThis->iChannels, iType);
+  }
+}
+static void addFrame(SSG* pThis, const float *pfValues) {
+  switch (pThis->iSampleType) {
+    case SSG_SAMPLE_INT8:   addFrameType(pThis, pfValues, SSG_SAMPLE_INT8);   break;
+    case SSG_SAMPLE_INT16:  addFrameType(pThis, pfValues, SSG_SAMPLE_INT16);  break;
+    case SSG_SAMPLE_HALF:   addFrameType(pThis, pfValues, SSG_SAMPLE_HALF);   break;
+    case SSG_SAMPLE_DOUBLE: addFrameType(pThis, pfValues, SSG_SAMPLE_DOUBLE); break;
+    default:                addFrameType(pThis, pfValues, SSG_SAMPLE_FLOAT);  break;
+  }
+}
+__attribute__((always_inline))
+static inline void encodeValuesType(SSG* pThis, const float *pfValues, void *pDst, size_t iCount, int iType) {
+  size_t i;
+  for (i = 0; i < iCount; i++) encodeValue(pThis, pDst, i, pfValues[i], iType);
+}
+// Physical values to the sample type, for pDst of iCount values
+static void encodeValues(SSG* pThis, const float *pfValues, void *pDst, size_t iCount) {
+  switch (pThis->iSampleType) {
+    case SSG_SAMPLE_INT8:   encodeValuesType(pThis, pfValues, pDst, iCount, SSG_SAMPLE_INT8);   break;
+    case SSG_SAMPLE_INT16:  encodeValuesType(pThis, pfValues, pDst, iCount, SSG_SAMPLE_INT16);  break;
+    case SSG_SAMPLE_HALF:   encodeValuesType(pThis, pfValues, pDst, iCount, SSG_SAMPLE_HALF);   break;
+    case SSG_SAMPLE_DOUBLE: encodeValuesType(pThis, pfValues, pDst, iCount, SSG_SAMPLE_DOUBLE); break;
+    default:                encodeValuesType(pThis, pfValues, pDst, iCount, SSG_SAMPLE_FLOAT);  break;
+  }
+}
+
+typedef struct {
+  SSG *pThis;
+  uint64_t iStart;             // first raw sample to rebuild from, the first one kept
+  uint64_t iLength;            // number of raw samples to rebuild from
+  int iChunkLevels;            // levels reduced within a chunk
+  int iChunkLog2;              // raw samples per chunk
+  volatile uint64_t iNextChunk; // next chunk to hand out, taken with atomic add
+} RebuildJob;
+
+// Raw chunks are aligned to about 2^REBUILD_CHUNK_LOG2 samples, a whole number of groups of the highest level
+// reduced within a chunk, so those levels never group across chunks.
+#define REBUILD_CHUNK_LOG2 18
+
+static void *rebuildWorker(void *pArg) {
+  RebuildJob *pJob = pArg;
+  int iFanoutLog2 = pJob->pThis->iFanoutLog2;
+  uint64_t iChunks = (pJob->iLength + (1<<pJob->iChunkLog2) - 1) >> pJob->iChunkLog2;
+  uint64_t iChunk;
+  int iLevel;
+  while ((iChunk = __sync_fetch_and_add(&pJob->iNextChunk, 1)) < iChunks) {
+    uint64_t iStart = MAX(iChunk << pJob->iChunkLog2, pJob->iStart);
+    uint64_t iEnd = MIN((iChunk + 1) << pJob->iChunkLog2, pJob->iLength);
+    for (iLevel=1; iLevel<=pJob->iChunkLevels; iLevel++) {
+      reduceLevel(pJob->pThis, iLevel, iStart >> (iLevel*iFanoutLog2), iEnd >> (iLevel*iFanoutLog2));
+    }
+    if (pJob->pThis->iMomentLog2 != 0) {
+      frameMoments(pJob->pThis, iStart >> pJob->pThis->iMomentLog2, iEnd >> pJob->pThis->iMomentLog2);
+      for (iLevel = pJob->pThis->iMomentLog2 / iFanoutLog2 + 1; iLevel <= pJob->iChunkLevels; iLevel++) {
+        reduceMoments(pJob->pThis, iLevel, iStart >> (iLevel*iFanoutLog2), iEnd >> (iLevel*iFanoutLog2));
+      }
+    }
+  }
+  return NULL;
+}
+
+static int linear(float v1, float v2, float f) {
+  int iv = 255.0f * (v1+(v2-v1)*f);
+  return iv;
+}
+
+
+
+/*
+ * Column rasterizer
+ *
+ * Each column is covered by up to four row intervals (base and next LOD, two sample pairs each). The pixel value
+ * only depends on which intervals cover the row, so it is looked up in a per-column table of 16 entries.
+ * Columns are filled span by span, or with SIMD across 16/32 neighbouring columns one row at a time.
+ */
+
+typedef struct {
+  int aiLo[4];       // first row covered by each interval
+  int aiHi[4];       // last row covered, less than aiLo if the interval is empty
+  uint8_t aiLut[16]; // pixel value, indexed by bitmask of covering intervals
+} ColumnSpans;
+
+// Clamping before the int conversion keeps (int) truncation identical for all rows inside the buffer.
+static int rowOf(float fY, int iHeight) {
+  if (fY < -1.0f) fY = -1.0f;
+  if (fY > (float)iHeight) fY = (float)iHeight;
+  return (int)fY;
+}
+static void setSpan(ColumnSpans *pCol, int iSpan, float fLo, float fHi, int iHeight) {
+  pCol->aiLo[iSpan] = MAX(rowOf(fLo, iHeight), 0);
+  pCol->aiHi[iSpan] = MIN(rowOf(fHi, iHeight), iHeight-1);
+}
+
+// Rows where the set of covering intervals changes, sorted, followed by iHeight. Returns the number of runs.
+static int columnBreaks(const ColumnSpans *pCol, int *aiBreak, int iHeight) {
+  int iBreaks = 0;
+  int i, j;
+
+  aiBreak[iBreaks++] = 0;
+  for (i = 0; i < 4; i++) {
+    if (pCol->aiLo[i] > pCol->aiHi[i]) continue;
+    aiBreak[iBreaks++] = pCol->aiLo[i];
+    aiBreak[iBreaks++] = pCol->aiHi[i] + 1;
+  }
+  for (i = 1; i < iBreaks; i++) {
+    int iBreak = aiBreak[i];
+    for (j = i; j > 0 && aiBreak[j-1] > iBreak; j--) aiBreak[j] = aiBreak[j-1];
+    aiBreak[j] = iBreak;
+  }
+  aiBreak[iBreaks] = iHeight;
+  return iBreaks;
+}
+static uint8_t rowValue(const ColumnSpans *pCol, int y) {
+  int iMask = 0;
+  int j;
+  for (j = 0; j < 4; j++) {
+    if (pCol->aiLo[j] <= y && y <= pCol->aiHi[j]) iMask |= 1<<j;
+  }
+  return pCol->aiLut[iMask];
+}
+
+static void rasterizeColumnScalar(const ColumnSpans *pCol, uint8_t *pDst, int iStride, int iHeight) {
+  int aiBreak[10];
+  int iBreaks = columnBreaks(pCol, aiBreak, iHeight);
+  int i, y;
+
+  for (i = 0; i < iBreaks; i++) {
+    uint8_t iv;
+    if (aiBreak[i] == aiBreak[i+1]) continue;
+    iv = rowValue(pCol, aiBreak[i]);
+    if (iStride == 1) {
+      memset(pDst + aiBreak[i], iv, aiBreak[i+1] - aiBreak[i]);
+    } else {
+      for (y = aiBreak[i]; y < aiBreak[i+1]; y++) {
+        pDst[(size_t)y*iStride] = iv;
+      }
+    }
+  }
+}
+// Draw a column over what is already in a contiguous column, keeping the brighter pixel
+static void rasterizeColumnMax(const ColumnSpans *pCol, uint8_t *pDst, int iHeight) {
+  int aiBreak[10];
+  int iBreaks = columnBreaks(pCol, aiBreak, iHeight);
+  int i, y;
+
+  for (i = 0; i < iBreaks; i++) {
+    uint8_t iv = rowValue(pCol, aiBreak[i]);
+    if (iv == 0) continue;
+    for (y = aiBreak[i]; y < aiBreak[i+1]; y++) {
+      pDst[y] = MAX(pDst[y], iv);
+    }
+  }
+}
+
+#ifdef HAVE_SSE2_RASTERIZER
+#define SSE2_COLUMNS 16
+
+static inline __m128i selectSSE2(__m128i out, __m128i ifOut, __m128i ifIn) {
+  return _mm_or_si128(_mm_and_si128(out, ifOut), _mm_andnot_si128(out, ifIn));
+}
+
+static void rasterizeGroupSSE2(const ColumnSpans *pCol, uint8_t *pDst, int iStride, int iHeight) {
+  uint8_t aiLut[16][SSE2_COLUMNS];
+  int16_t aiLo[4][SSE2_COLUMNS], aiHi[4][SSE2_COLUMNS];
+  __m128i aLut[16], aLo[4][2], aHi[4][2];
+  int c, i, y;
+  int iFirst = iHeight, iLast = -1;
+
+  for (c = 0; c < SSE2_COLUMNS; c++) {
+    for (i = 0; i < 16; i++) aiLut[i][c] = pCol[c].aiLut[i];
+    for (i = 0; i < 4; i++) {
+      aiLo[i][c] = (int16_t)pCol[c].aiLo[i];
+      aiHi[i][c] = (int16_t)pCol[c].aiHi[i];
+      if (pCol[c].aiLo[i] <= pCol[c].aiHi[i]) {
+        iFirst = MIN(iFirst, pCol[c].aiLo[i]);
+        iLast = MAX(iLast, pCol[c].aiHi[i]);
+      }
+    }
+  }
+  for (i = 0; i < 16; i++) aLut[i] = _mm_loadu_si128((const __m128i*)aiLut[i]);
+  for (i = 0; i < 4; i++) {
+    aLo[i][0] = _mm_loadu_si128((const __m128i*)&aiLo[i][0]);
+    aLo[i][1] = _mm_loadu_si128((const __m128i*)&aiLo[i][8]);
+    aHi[i][0] = _mm_loadu_si128((const __m128i*)&aiHi[i][0]);
+    aHi[i][1] = _mm_loadu_si128((const __m128i*)&aiHi[i][8]);
+  }
+
+  for (y = 0; y < iHeight; y++) {
+    __m128i v = aLut[0];
+    if (iFirst <= y && y <= iLast) {
+      __m128i vy = _mm_set1_epi16((int16_t)y);
+      __m128i aOut[4], aSel[8];
+      for (i = 0; i < 4; i++) {
+        __m128i out0 = _mm_or_si128(_mm_cmpgt_epi16(aLo[i][0], vy), _mm_cmpgt_epi16(vy, aHi[i][0]));
+        __m128i out1 = _mm_or_si128(_mm_cmpgt_epi16(aLo[i][1], vy), _mm_cmpgt_epi16(vy, aHi[i][1]));
+        aOut[i] = _mm_packs_epi16(out0, out1);
+      }
+      // Binary select tree over the table, one interval bit per level
+      for (i = 0; i < 8; i++) aSel[i] = selectSSE2(aOut[0], aLut[2*i], aLut[2*i+1]);
+      for (i = 0; i < 4; i++) aSel[i] = selectSSE2(aOut[1], aSel[2*i], aSel[2*i+1]);
+      for (i = 0; i < 2; i++) aSel[i] = selectSSE2(aOut[2], aSel[2*i], aSel[2*i+1]);
+      v = selectSSE2(aOut[3], aSel[0], aSel[1]);
+    }
+    _mm_storeu_si128((__m128i*)(pDst + y*iStride), v);
+  }
+}
+#endif
+
+#ifdef HAVE_AVX2_RASTERIZER
+#define AVX2_COLUMNS 32
+
+__attribute__((target("avx2")))
+static void rasterizeGroupAVX2(const ColumnSpans *pCol, uint8_t *pDst, int iStride, int iHeight) {
+  uint8_t aiLut[16][AVX2_COLUMNS];
+  int16_t aiLo[4][AVX2_COLUMNS], aiHi[4][AVX2_COLUMNS];
+  __m256i aLut[16], aLo[4][2], aHi[4][2];
+  int c, i, y;
+  int iFirst = iHeight, iLast = -1;
+
+  for (c = 0; c < AVX2_COLUMNS; c++) {
+    for (i = 0; i < 16; i++) aiLut[i][c] = pCol[c].aiLut[i];
+    for (i = 0; i < 4; i++) {
+      aiLo[i][c] = (int16_t)pCol[c].aiLo[i];
+      aiHi[i][c] = (int16_t)pCol[c].aiHi[i];
+      if (pCol[c].aiLo[i] <= pCol[c].aiHi[i]) {
+        iFirst = MIN(iFirst, pCol[c].aiLo[i]);
+        iLast = MAX(iLast, pCol[c].aiHi[i]);
+      }
+    }
+  }
+  for (i = 0; i < 16; i++) aLut[i] = _mm256_loadu_si256((const __m256i*)aiLut[i]);
+  for (i = 0; i < 4; i++) {
+    aLo[i][0] = _mm256_loadu_si256((const __m256i*)&aiLo[i][0]);
+    aLo[i][1] = _mm256_loadu_si256((const __m256i*)&aiLo[i][16]);
+    aHi[i][0] = _mm256_loadu_si256((const __m256i*)&aiHi[i][0]);
+    aHi[i][1] = _mm256_loadu_si256((const __m256i*)&aiHi[i][16]);
+  }
+
+  for (y = 0; y < iHeight; y++) {
+    __m256i v = aLut[0];
+    if (iFirst <= y && y <= iLast) {
+      __m256i vy = _mm256_set1_epi16((int16_t)y);
+      __m256i aOut[4], aSel[8];
+      for (i = 0; i < 4; i++) {
+        __m256i out0 = _mm256_or_si256(_mm256_cmpgt_epi16(aLo[i][0], vy), _mm256_cmpgt_epi16(vy, aHi[i][0]));
+        __m256i out1 = _mm256_or_si256(_mm256_cmpgt_epi16(aLo[i][1], vy), _mm256_cmpgt_epi16(vy, aHi[i][1]));
+        // packs works per 128-bit lane, put the quadwords back in column order
+        aOut[i] = _mm256_permute4x64_epi64(_mm256_packs_epi16(out0, out1), 0xD8);
+      }
+      for (i = 0; i < 8; i++) aSel[i] = _mm256_blendv_epi8(aLut[2*i+1], aLut[2*i], aOut[0]);
+      for (i = 0; i < 4; i++) aSel[i] = _mm256_blendv_epi8(aSel[2*i+1], aSel[2*i], aOut[1]);
+      for (i = 0; i < 2; i++) aSel[i] = _mm256_blendv_epi8(aSel[2*i+1], aSel[2*i], aOut[2]);
+      v = _mm256_blendv_epi8(aSel[1], aSel[0], aOut[3]);
+    }
+    _mm256_storeu_si256((__m256i*)(pDst + y*iStride), v);
+  }
+}
+#endif
+
+static void rasterizeColumns(const ColumnSpans *pColumns, int iColumns, uint8_t *pDst, int iStride, int iHeight) {
+  int x = 0;
+#if defined(HAVE_SSE2_RASTERIZER) || defined(HAVE_AVX2_RASTERIZER)
+  if (iHeight <= INT16_MAX) {
+#ifdef HAVE_AVX2_RASTERIZER
+    if (__builtin_cpu_supports("avx2")) {
+      for (; x + AVX2_COLUMNS <= iColumns; x += AVX2_COLUMNS) {
+        rasterizeGroupAVX2(pColumns + x, pDst + x, iStride, iHeight);
+      }
+    }
+#endif
+#ifdef HAVE_SSE2_RASTERIZER
+    for (; x + SSE2_COLUMNS <= iColumns; x += SSE2_COLUMNS) {
+      rasterizeGroupSSE2(pColumns + x, pDst + x, iStride, iHeight);
+    }
+#endif
+  }
+#endif
+  for (; x < iColumns; x++) {
+    rasterizeColumnScalar(pColumns + x, pDst + x, iStride, iHeight);
+  }
+}
+
+void SSG_AddValue(SSG *pThis, float fValue) {
+  if (pThis->iChannels != 1) return;
+  SSG_AddFrame(pThis, &fValue);
+}
+void SSG_AddValues(SSG *pThis, const float *pfValues, size_t iCount) {
+  if (pThis->iChannels != 1) return;
+  SSG_AddFrames(pThis, pfValues, iCount);
+}
+// Frames in the sample type, with times if piTimes isn't NULL
+static void addRawFrames(SSG *pThis, const void *pFrames, const int64_t *piTimes, size_t iFrames) {
+  const uint8_t *pSrc = pFrames;
+  while (iFrames > 0) {
+    size_t iChunk = MIN(iFrames, INGEST_CHUNK);
+    addSamples(pThis, pSrc, piTimes, iChunk);
+    pSrc += iChunk * pThis->samples.iEntrySize;
+    if (piTimes != NULL) piTimes += iChunk;
+    iFrames -= iChunk;
+  }
+}
+// Frames of physical values, with times if piTimes isn't NULL
+static void addFrames(SSG *pThis, const float *pfValues, const int64_t *piTimes, size_t iFrames) {
+  size_t iChunkFrames = INGEST_CHUNK / pThis->iChannels;
+  if (pThis->bPassThrough) {
+    addRawFrames(pThis, pfValues, piTimes, iFrames);
+    return;
+  }
+  if (pThis->pEncodeBuffer == NULL) {
+    pThis->pEncodeBuffer = malloc((size_t)INGEST_CHUNK * sampleSize(pThis->iSampleType));
+    if (pThis->pEncodeBuffer == NULL) return;
+  }
+  while (iFrames > 0) {
+    size_t iChunk = MIN(iFrames, iChunkFrames);
+    encodeValues(pThis, pfValues, pThis->pEncodeBuffer, iChunk * pThis->iChannels);
+    addSamples(pThis, pThis->pEncodeBuffer, piTimes, iChunk);
+    pfValues += iChunk * pThis->iChannels;
+    if (piTimes != NULL) piTimes += iChunk;
+    iFrames -= iChunk;
+  }
+}
+void SSG_AddFrame(SSG *pThis, const float *pfValues) {
+  if (!pThis->bWritable || pThis->bTimestamps) return;
+  addFrame(pThis, pfValues);
+}
+void SSG_AddFrames(SSG *pThis, const float *pfValues, size_t iFrames) {
+  if (!pThis->bWritable || pThis->bTimestamps) return;
+  addFrames(pThis, pfValues, NULL, iFrames);
+}
+void SSG_AddRawFrames(SSG *pThis, const void *pFrames, size_t iFrames) {
+  if (!pThis->bWritable || pThis->bTimestamps) return;
+  addRawFrames(pThis, pFrames, NULL, iFrames);
+}
+int SSG_AddTimedFrames(SSG *pThis, const int64_t *piTimes, const float *pfValues, size_t iFrames) {
+  uint64_t iLength = pThis->samples.iWritePointer;
+  int64_t iPrev = iLength > 0 ? frameTime(pThis, iLength - 1) : INT64_MIN;
+  size_t i;
+
+  if (!pThis->bWritable || !pThis->bTimestamps) return -1;
+  for (i = 0; i < iFrames; i++) {
+    if (piTimes[i] < iPrev) return -1;
+    iPrev = piTimes[i];
+  }
+  addFrames(pThis, pfValues, piTimes, iFrames);
+  return 0;
+}
+// First raw frame an edit may rewrite: older ones are dropped, compressed, or may be compressed right now by the
+// cold storage thread. Writer only, the length and iHotSamples only change on the writer.
+static uint64_t firstEditable(SSG *pThis) {
+  uint64_t iLength = pThis->samples.iWritePointer;
+  uint64_t iFirst = MAX(retainedStart(pThis, iLength), coldLength(pThis));
+  if (pThis->bColdThread && iLength > pThis->iHotSamples) {
+    iFirst = MAX(iFirst, ((iLength - pThis->iHotSamples) >> COLD_BLOCK_LOG2) << COLD_BLOCK_LOG2);
+  }
+  return iFirst;
+}
+// Overwrite frames of physical values from iStart, then repair the level entries and moments over them, each
+// level once for the whole range. Reading calls that overlap it read again, see Concurrent readers.
+static int setFrames(SSG *pThis, uint64_t iStart, const float *pfValues, size_t iFrames) {
+  Buffer *pSamples = &pThis->samples;
+  uint64_t iLength = pSamples->iWritePointer;
+  uint64_t iEnd = iStart + iFrames;
+  size_t iChunkFrames = INGEST_CHUNK / pThis->iChannels;
+  uint64_t i;
+  int iLevel;
+
+  if (!pThis->bWritable || iStart < firstEditable(pThis) || iStart > iLength || iFrames > iLength - iStart) return -1;
+  if (iFrames == 0) return 0;
+  if (!pThis->bPassThrough && pThis->pEncodeBuffer == NULL) {
+    pThis->pEncodeBuffer = malloc((size_t)INGEST_CHUNK * sampleSize(pThis->iSampleType));
+    if (pThis->pEncodeBuffer == NULL) return -1;
+  }
+
+  beginRewrite(pThis);
+  for (i = iStart; i < iEnd; ) {
+    uint64_t iChunk = MIN(iEnd - i, iChunkFrames);
+    const uint8_t *pSrc = (const uint8_t*)pfValues;
+    if (!pThis->bPassThrough) {
+      encodeValues(pThis, pfValues, pThis->pEncodeBuffer, iChunk * pThis->iChannels);
+      pSrc = pThis->pEncodeBuffer;
+    }
+    pfValues += iChunk * pThis->iChannels;
+    while (iChunk > 0) {
+      uint64_t iRun = MIN(iChunk, bufferRun(pSamples, i));
+      memcpy(entryPtr(pSamples, i), pSrc, iRun*pSamples->iEntrySize);
+      pSrc += iRun*pSamples->iEntrySize;
+      i += iRun;
+      iChunk -= iRun;
+    }
+  }
+  // Only complete entries exist, the groups of the last ones are filled in as samples are added
+  for (iLevel = 1; iLevel <= pThis->iLevels; iLevel++) {
+    int iShift = iLevel * pThis->iFanoutLog2;
+    uint64_t iTo = MIN(((iEnd - 1) >> iShift) + 1, levelLength(pThis, iLevel, iLength));
+    if ((iStart >> iShift) >= iTo) break;
+    reduceLevel(pThis, iLevel, iStart >> iShift, iTo);
+  }
+  if (pThis->iMomentLog2 != 0) repairMoments(pThis, iStart, iEnd);
+  endRewrite(pThis);
+  __atomic_fetch_add(&pThis->iRewrittenBytes, iFrames * pSamples->iEntrySize, __ATOMIC_RELAXED);
+  __atomic_store_n(&pThis->bRewritten, 1, __ATOMIC_RELEASE);
+  if (pThis->iFlushBytes != 0) requestFlush(pThis);
+  return 0;
+}
+int SSG_SetValue(SSG *pThis, uint64_t iIndex, float fValue) {
+  if (pThis->iChannels != 1) return -1;
+  return setFrames(pThis, iIndex, &fValue, 1);
+}
+int SSG_SetValues(SSG *pThis, uint64_t iStart, const float *pfValues, size_t iCount) {
+  if (pThis->iChannels != 1) return -1;
+  return setFrames(pThis, iStart, pfValues, iCount);
+}
+int SSG_SetFrames(SSG *pThis, uint64_t iStart, const float *pfValues, size_t iFrames) {
+  return setFrames(pThis, iStart, pfValues, iFrames);
+}
+int SSG_RebuildLods(SSG *pThis, int iThreads) {
+  RebuildJob job;
+  pthread_t aThreads[REBUILD_MAX_THREADS];
+  uint64_t iLength = pThis->samples.iWritePointer;
+  int i, iLevel;
+
+  if (!pThis->bWritable) return -1;
+  if (iThreads <= 0) iThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  iThreads = MAX(1, MIN(iThreads, REBUILD_MAX_THREADS));
+
+  // Allocate every level up front, the workers only write into existing extents.
+  for (iLevel=1; iLevel<=pThis->iLevels; iLevel++) {
+    if (reserveEntries(pThis, iLevel, iLength >> (iLevel*pThis->iFanoutLog2)) != 0) return -1;
+  }
+  for (iLevel = pThis->iMomentLog2 / pThis->iFanoutLog2; pThis->iMomentLog2 != 0 && iLevel <= pThis->iLevels; iLevel++) {
+    if (reserveMoments(pThis, iLevel, iLength >> (iLevel*pThis->iFanoutLog2)) != 0) return -1;
+  }
+
+  // Raw frames may go cold while the workers read them. The published entries are rewritten in place, so reading
+  // calls that overlap the rebuild read again, and render caches redraw.
+  int iEpoch = readerEnter(pThis);
+  beginRewrite(pThis);
+  job.pThis = pThis;
+  job.iStart = retainedStart(pThis, iLength);
+  job.iLength = iLength;
+  job.iChunkLevels = MIN(REBUILD_CHUNK_LOG2 / pThis->iFanoutLog2, pThis->iLevels);
+  job.iChunkLog2 = job.iChunkLevels * pThis->iFanoutLog2;
+  job.iNextChunk = job.iStart >> job.iChunkLog2;
+  for (i=1; i<iThreads; i++) {
+    if (pthread_create(&aThreads[i], NULL, rebuildWorker, &job) != 0) break;
+  }
+  rebuildWorker(&job);
+  while (--i > 0) {
+    pthread_join(aThreads[i], NULL);
+  }
+
+  // Stitch the chunks together in the levels above the chunk size. These are small, so do them serially.
+  for (iLevel=job.iChunkLevels+1; iLevel<=pThis->iLevels; iLevel++) {
+    reduceLevel(pThis, iLevel, job.iStart >> (iLevel*pThis->iFanoutLog2), iLength >> (iLevel*pThis->iFanoutLog2));
+  }
+  readerExit(pThis, iEpoch);
+  for (iLevel = pThis->iMomentLog2 / pThis->iFanoutLog2; pThis->iMomentLog2 != 0 && iLevel <= pThis->iLevels; iLevel++) {
+    if (iLevel > job.iChunkLevels) {
+      reduceMoments(pThis, iLevel, job.iStart >> (iLevel*pThis->iFanoutLog2), iLength >> (iLevel*pThis->iFanoutLog2));
+    }
+    momentBuffer(pThis, iLevel)->iWritePointer = iLength >> (iLevel*pThis->iFanoutLog2);
+  }
+
+  for (iLevel=1; iLevel<=pThis->iLevels; iLevel++) {
+    levelBuffer(pThis, iLevel)->iWritePointer = iLength >> (iLevel*pThis->iFanoutLog2);
+  }
+  endRewrite(pThis);
+  __atomic_store_n(&pThis->bRewritten, 1, __ATOMIC_RELEASE);
+  publishLength(pThis);
+  return 0;
+}
+int SSG_ConvertMultiFile(char *pcBasefilename, const SSG_Options *pOptions) {
+  char acFilename[1024];
+  char acTmpFilename[1024];
+  SSG_Options options = { 0 };
+  float *pfBlock;
+  ssize_t iRead;
+  SSG *pThis;
+  int fd;
+
+  snprintf(acFilename, sizeof(acFilename), "%s.ssg", pcBasefilename);
+  snprintf(acTmpFilename, sizeof(acTmpFilename), "%s.ssg.tmp", pcBasefilename);
+  if (access(acFilename, F_OK) == 0) return -1;
+
+  snprintf(acFilename, sizeof(acFilename), "%s_rawsamples.bin", pcBasefilename);
+  fd = open(acFilename, O_RDONLY);
+  if (fd < 0) return -1;
+  unlink(acTmpFilename);
+  if (pOptions != NULL) options = *pOptions;
+  options.iChannels = 1; // the old layout has a single series of floats
+  options.iSampleType = SSG_SAMPLE_FLOAT;
+  options.dScale = 0.0;
+  options.dOffset = 0.0;
+  options.bTimestamps = 0;
+  pThis = openContainer(acTmpFilename, 1, &options);
+  pfBlock = malloc(INGEST_CHUNK * sizeof(float));
+  if (pThis == NULL || pfBlock == NULL) {
+    if (pThis != NULL) closeContainer(pThis);
+    free(pfBlock);
+    close(fd);
+    return -1;
+  }
+
+  // The levels are a function of the raw samples, regenerating them is as cheap as reading the old level files
+  while ((iRead = read(fd, pfBlock, INGEST_CHUNK * sizeof(float))) > 0) {
+    if (appendRaw(pThis, pfBlock, NULL, iRead / sizeof(float)) != 0) break;
+  }
+  free(pfBlock);
+  close(fd);
+  if (iRead != 0) {
+    closeContainer(pThis);
+    unlink(acTmpFilename);
+    return -1;
+  }
+  SSG_RebuildLods(pThis, 0);
+  // The container must be on disk before it replaces the old files
+  flushContainer(pThis, 1);
+  closeContainer(pThis);
+
+  snprintf(acFilename, sizeof(acFilename), "%s.ssg", pcBasefilename);
+  return rename(acTmpFilename, acFilename);
+}
+uint64_t SSG_GetLength(SSG *pThis) {
+  return publishedLength(pThis);
+}
+int SSG_Flush(SSG *pThis, int bWait) {
+  return flushContainer(pThis, bWait);
+}
+uint64_t SSG_TimeToIndex(SSG *pThis, int64_t iTime) {
+  return timeLowerBound(pThis, publishedLength(pThis), iTime);
+}
+uint64_t SSG_GetFirstSample(SSG *pThis) {
+  return retainedStart(pThis, publishedLength(pThis));
+}
+int64_t SSG_GetTime(SSG *pThis, uint64_t iIndex) {
+  uint64_t iLength = publishedLength(pThis);
+  if (iIndex >= iLength || iIndex < retainedStart(pThis, iLength)) return INT64_MIN;
+  return frameTime(pThis, iIndex);
+}
+int SSG_SetAutoFlush(SSG *pThis, int iIntervalMs, uint64_t iBytes) {
+  if (!pThis->bWritable || iIntervalMs < 0) return -1;
+  if (iIntervalMs == 0 && iBytes == 0) {
+    stopFlushThread(pThis);
+    pThis->iFlushBytes = 0;
+    return 0;
+  }
+  pthread_mutex_lock(&pThis->flushLock);
+  pThis->iFlushIntervalMs = iIntervalMs;
+  pThis->iFlushBytes = iBytes;
+  pThis->bFlushStop = 0;
+  if (!pThis->bFlushThread) {
+    pThis->bFlushThread = pthread_create(&pThis->flushThread, NULL, flushWorker, pThis) == 0;
+  }
+  pthread_cond_signal(&pThis->flushWake);
+  int bRunning = pThis->bFlushThread;
+  pthread_mutex_unlock(&pThis->flushLock);
+  return bRunning ? 0 : -1;
+}
+int SSG_SetColdStorage(SSG *pThis, int bEnable, uint64_t iHotSamples) {
+  if (!pThis->bWritable || pThis->iRetainSamples != UINT64_MAX) return -1;
+  if (!bEnable) {
+    stopColdThread(pThis);
+    return 0;
+  }
+  pthread_mutex_lock(&pThis->coldLock);
+  // The writer reads back into the last groups of raw frames, those must stay uncompressed
+  pThis->iHotSamples = MAX(iHotSamples, (uint64_t)1 << COLD_BLOCK_LOG2);
+  pThis->bColdStop = 0;
+  if (!pThis->bColdThread) {
+    pThis->bColdThread = pthread_create(&pThis->coldThread, NULL, coldWorker, pThis) == 0;
+  }
+  pthread_cond_signal(&pThis->coldWake);
+  int bRunning = pThis->bColdThread;
+  pthread_mutex_unlock(&pThis->coldLock);
+  return bRunning ? 0 : -1;
+}
+void SSG_Prefetch(SSG *pThis, uint64_t iStart, uint64_t iEnd, int iLod) {
+  iLod = MAX(0, MIN(iLod, MAX_MIP_LOD));
+  iEnd = MIN(iEnd, publishedLength(pThis));
+  if (iStart >= iEnd) return;
+  prefetchRange(pThis, (double)iStart, (double)iEnd, iLod);
+}
+int SSG_SetPrefetch(SSG *pThis, int bEnable) {
+  if (!bEnable) {
+    stopPrefetchThread(pThis);
+    return 0;
+  }
+  pthread_mutex_lock(&pThis->prefetchLock);
+  pThis->bPrefetchStop = 0;
+  if (!pThis->bPrefetchThread) {
+    __atomic_store_n(&pThis->bPrefetchThread, pthread_create(&pThis->prefetchThread, NULL, prefetchWorker, pThis) == 0, __ATOMIC_RELAXED);
+  }
+  int bRunning = pThis->bPrefetchThread;
+  pthread_mutex_unlock(&pThis->prefetchLock);
+  return bRunning ? 0 : -1;
+}
+int SSG_GetChannels(SSG *pThis) {
+  return pThis->iChannels;
+}
+int SSG_GetSampleType(SSG *pThis) {
+  return pThis->iSampleType;
+}
+void SSG_EnableStats(SSG *pThis, int bEnable) {
+  if (bEnable && !statsEnabled(pThis)) {
+    uint64_t *piCounter = (uint64_t*)&pThis->stats;
+    size_t i;
+    for (i = 0; i < sizeof(Counters) / sizeof(uint64_t); i++) __atomic_store_n(&piCounter[i], 0, __ATOMIC_RELAXED);
+  }
+  __atomic_store_n(&pThis->bStats, bEnable ? 1 : 0, __ATOMIC_RELAXED);
+}
+void SSG_GetStats(SSG *pThis, SSG_Stats *pStats) {
+  uint64_t iLength = publishedLength(pThis);
+  int i;
+
+  memset(pStats, 0, sizeof(SSG_Stats));
+  pStats->iSamples = iLength;
+  pStats->iSamplesAdded = iLength - pThis->iOpenLength;
+  pStats->iLevels = pThis->iLevels + 1;
+  for (i = 0; i <= pThis->iLevels; i++) {
+    Buffer *pB = levelBuffer(pThis, i);
+    pStats->aiLevelBytes[i] = (levelLength(pThis, i, iLength) - levelLength(pThis, i, retainedStart(pThis, iLength))) * pB->iEntrySize;
+    pStats->aiLevelAllocatedBytes[i] = extentStart(__atomic_load_n(&pB->iExtents, __ATOMIC_RELAXED)) * pB->iEntrySize;
+  }
+  int iWindows = __atomic_load_n(&pThis->iWindows, __ATOMIC_ACQUIRE);
+  for (i = 0; i < iWindows; i++) pStats->iBytesMapped += pThis->aWindows[i].iSize;
+  pStats->iFileBytes = __atomic_load_n(&pThis->iFileCapacity, __ATOMIC_RELAXED);
+
+  pStats->iMaps = statsGet(&pThis->stats.iMaps);
+  pStats->dMapSeconds = statsGet(&pThis->stats.iMapNs) * 1e-9;
+  pStats->iFileGrowths = statsGet(&pThis->stats.iFileGrowths);
+  pStats->dFileGrowthSeconds = statsGet(&pThis->stats.iFileGrowthNs) * 1e-9;
+  pStats->iSyncs = statsGet(&pThis->stats.iSyncs);
+  pStats->dSyncSeconds = statsGet(&pThis->stats.iSyncNs) * 1e-9;
+  pStats->iRenders = statsGet(&pThis->stats.iRenders);
+  pStats->dRenderSeconds = statsGet(&pThis->stats.iRenderNs) * 1e-9;
+  pStats->dMaxRenderSeconds = statsGet(&pThis->stats.iMaxRenderNs) * 1e-9;
+  pStats->iColumnsRendered = statsGet(&pThis->stats.iColumnsRendered);
+  pStats->iLastLod = (int)statsGet(&pThis->stats.iLastLod);
+  for (i = 0; i < SSG_STATS_LEVELS; i++) pStats->aiRendersPerLod[i] = statsGet(&pThis->stats.aiRendersPerLod[i]);
+  pStats->iRenderMinorFaults = statsGet(&pThis->stats.iRenderMinorFaults);
+  pStats->iRenderMajorFaults = statsGet(&pThis->stats.iRenderMajorFaults);
+  pStats->iColdSamples = coldLength(pThis);
+  pStats->iColdBytes = __atomic_load_n(&pThis->coldData.iWritePointer, __ATOMIC_RELAXED);
+  pStats->iColdCacheMisses = statsGet(&pThis->stats.iColdCacheMisses);
+}
+
+// Fold entries [iFrom, iTo) of a level into the running min/max of every channel
+__attribute__((always_inline))
+static inline void combineEntries(const Buffer *pB, uint64_t iFrom, uint64_t iTo, SampleValue *pvMin, SampleValue *pvMax, int iChannels, int iType) {
+  int iValues = pB->iValues;
+  uint64_t i;
+  int c;
+  while (iFrom < iTo) {
+    uint64_t iRun = MIN(bufferRun(pB, iFrom), iTo - iFrom);
+    const void *pEntry = entryPtr(pB, iFrom);
+    for (i=0; i<iRun; i++) {
+      for (c=0; c<iChannels; c++) {
+        pvMin[c] = MIN(pvMin[c], loadValue(pEntry, i*pB->iStride + c*iValues, iType));
+        pvMax[c] = MAX(pvMax[c], loadValue(pEntry, i*pB->iStride + c*iValues + iValues-1, iType));
+      }
+    }
+    iFrom += iRun;
+  }
+}
+__attribute__((always_inline))
+static inline void combineLevel(SSG *pThis, int iLevel, uint64_t iColdLength, uint64_t iFrom, uint64_t iTo, SampleValue *pvMin, SampleValue *pvMax, int iType) {
+  if (iLevel == 0 && iFrom < iColdLength) {
+    uint64_t iCold = MIN(iTo, iColdLength);
+    combineColdEntries(pThis, iFrom, iCold, pvMin, pvMax);
+    iFrom = iCold;
+  }
+  combineEntries(levelBuffer(pThis, iLevel), iFrom, iTo, pvMin, pvMax, pThis->iChannels, iType);
+}
+// Min/max of raw samples [iStart, iEnd) from the coarsest entries that fit: at each level the unaligned edges are
+// taken and the aligned middle is left to the level above, so at most 2*(fan-out - 1) entries per level are read.
+__attribute__((always_inline))
+static inline void queryRangeType(SSG *pThis, uint64_t iLength, uint64_t iColdLength, uint64_t iStart, uint64_t iEnd, SampleValue *pvMin, SampleValue *pvMax, int iType) {
+  uint64_t iMask = (1ULL << pThis->iFanoutLog2) - 1;
+  int iLevel;
+  for (iLevel=0; iStart<iEnd; iLevel++) {
+    if (iLevel == pThis->iLevels || levelLength(pThis, iLevel+1, iLength) == 0) {
+      combineLevel(pThis, iLevel, iColdLength, iStart, iEnd, pvMin, pvMax, iType);
+      break;
+    }
+    if (iStart & iMask) {
+      uint64_t iAligned = MIN((iStart | iMask) + 1, iEnd);
+      combineLevel(pThis, iLevel, iColdLength, iStart, iAligned, pvMin, pvMax, iType);
+      iStart = iAligned;
+    }
+    if (iStart < iEnd && (iEnd & iMask)) {
+      uint64_t iAligned = MAX(iEnd & ~iMask, iStart);
+      combineLevel(pThis, iLevel, iColdLength, iAligned, iEnd, pvMin, pvMax, iType);
+      iEnd = iAligned;
+    }
+    iStart >>= pThis->iFanoutLog2;
+    iEnd >>= pThis->iFanoutLog2;
+  }
+}
+// Min/max in stored units of every channel over raw samples [iStart, iEnd), a non-empty range below iLength
+static void queryRange(SSG *pThis, uint64_t iLength, uint64_t iColdLength, uint64_t iStart, uint64_t iEnd, SampleValue *pvMin, SampleValue *pvMax) {
+  int c;
+  for (c=0; c<pThis->iChannels; c++) {
+    pvMin[c] = INFINITY;
+    pvMax[c] = -INFINITY;
+  }
+  switch (pThis->iSampleType) {
+    case SSG_SAMPLE_INT8:   queryRangeType(pThis, iLength, iColdLength, iStart, iEnd, pvMin, pvMax, SSG_SAMPLE_INT8);   break;
+    case SSG_SAMPLE_INT16:  queryRangeType(pThis, iLength, iColdLength, iStart, iEnd, pvMin, pvMax, SSG_SAMPLE_INT16);  break;
+    case SSG_SAMPLE_HALF:   queryRangeType(pThis, iLength, iColdLength, iStart, iEnd, pvMin, pvMax, SSG_SAMPLE_HALF);   break;
+    case SSG_SAMPLE_DOUBLE: queryRangeType(pThis, iLength, iColdLength, iStart, iEnd, pvMin, pvMax, SSG_SAMPLE_DOUBLE); break;
+    default:                queryRangeType(pThis, iLength, iColdLength, iStart, iEnd, pvMin, pvMax, SSG_SAMPLE_FLOAT);  break;
+  }
+}
+int SSG_QueryRange(SSG *pThis, uint64_t iStart, uint64_t iEnd, float *pfMin, float *pfMax) {
+  SampleValue avMin[SSG_MAX_CHANNELS], avMax[SSG_MAX_CHANNELS];
+  uint64_t iLength = publishedLength(pThis);
+  int c, iEpoch, iAttempts = 0;
+  uint64_t iRewrites;
+
+  iStart = MAX(iStart, retainedStart(pThis, iLength));
+  iEnd = MIN(iEnd, iLength);
+  if (iStart >= iEnd) return -1;
+  do {
+    iEpoch = readerEnter(pThis);
+    iRewrites = readBegin(pThis);
+    queryRange(pThis, iLength, coldLength(pThis), iStart, iEnd, avMin, avMax);
+    readerExit(pThis, iEpoch);
+  } while (!readEnd(pThis, iRewrites, &iAttempts));
+  // The scale is positive, so min and max keep their order
+  for (c=0; c<pThis->iChannels; c++) {
+    pfMin[c] = (float)(avMin[c] * pThis->dScale + pThis->dOffset);
+    pfMax[c] = (float)(avMax[c] * pThis->dScale + pThis->dOffset);
+  }
+  return 0;
+}
+int SSG_AutoRange(SSG *pThis, double dLeftmostPixelSamplePos, double dRightmostPixelSamplePos, float *pfTopmostValue, float *pfBottommostValue) {
+  float afMin[SSG_MAX_CHANNELS], afMax[SSG_MAX_CHANNELS];
+  int c;
+
+  if (dRightmostPixelSamplePos <= 0.0 || dRightmostPixelSamplePos <= dLeftmostPixelSamplePos) return -1;
+  uint64_t iStart = dLeftmostPixelSamplePos > 0.0 ? (uint64_t)dLeftmostPixelSamplePos : 0;
+  uint64_t iEnd = (uint64_t)ceil(dRightmostPixelSamplePos);
+  if (SSG_QueryRange(pThis, iStart, iEnd, afMin, afMax) != 0) return -1;
+  float fMin = afMin[0], fMax = afMax[0];
+  for (c=1; c<pThis->iChannels; c++) {
+    fMin = MIN(fMin, afMin[c]);
+    fMax = MAX(fMax, afMax[c]);
+  }
+  if (fMax == fMin) {
+    // Flat signal, center it
+    float fHalf = MAX(fabsf(fMax) * 0.5f, 1.0f);
+    fMin -= fHalf;
+    fMax += fHalf;
+  }
+  *pfTopmostValue = fMax;
+  *pfBottommostValue = fMin;
+  return 0;
+}
+
+typedef struct {
+  double dSamplesPerPixel;
+  float fZeroAtYPixel;
+  float fPixelsPerUnit;
+  int iLOD;
+  float fFracLod;
+  double dLodScale;
+  int iHeight;
+  uint64_t iLength; // published length when the render started, the whole frame shows this much
+  uint64_t iColdLength; // raw samples read from cold storage
+  int iReaderEpoch;
+  uint64_t iRewrites; // edits when the reads started, see Concurrent readers
+  int iAttempts;      // reads repeated because of an edit, set to 0 before the first setupView
+} RenderView;
+
+static void setupView(SSG *pThis, RenderView *pView, double dLeftmostPixelSamplePos, double dRightmostPixelSamplePos, float fTopmostValue, float fBottommostValue, int iWidth, int iHeight) {
+  pView->dSamplesPerPixel = (dRightmostPixelSamplePos - dLeftmostPixelSamplePos) / (double)iWidth;
+
+  float fUnitsPerPixel = (fTopmostValue - fBottommostValue) / (float)iHeight;
+  pView->fZeroAtYPixel = (float)iHeight * fTopmostValue / (fTopmostValue - fBottommostValue);
+
+  float fLOD = (float)(log(pView->dSamplesPerPixel) / log(2.0) - 0.0);
+  if (fLOD<0.0f) fLOD=0.0f;
+  if (fLOD>MAX_MIP_LOD-1) fLOD=MAX_MIP_LOD-1;
+  pView->iLOD = (int)fLOD;
+  pView->fFracLod = fLOD - pView->iLOD;
+  pView->dLodScale = ldexp(1.0, -pView->iLOD);
+
+  pView->fPixelsPerUnit = 1.0f / fUnitsPerPixel;
+  pView->iLength = publishedLength(pThis);
+  pView->iReaderEpoch = readerEnter(pThis);
+  pView->iRewrites = readBegin(pThis);
+  pView->iColdLength = coldLength(pThis);
+  if (pThis->fScale != 1.0f || pThis->fOffset != 0.0f) {
+    // Map stored values straight to pixels
+    pView->fZeroAtYPixel -= pView->fPixelsPerUnit * pThis->fOffset;
+    pView->fPixelsPerUnit *= pThis->fScale;
+  }
+  pView->iHeight = iHeight;
+}
+// Every setupView is paired with this once the view's reads are done. Returns 0 if an edit overlapped them, the
+// caller then sets up the view and reads again.
+static int finishView(SSG *pThis, RenderView *pView) {
+  readerExit(pThis, pView->iReaderEpoch);
+  return readEnd(pThis, pView->iRewrites, &pView->iAttempts);
+}
+
+// Raw sample count from which a read of entry iPos at iLevel no longer changes as samples are appended
+static uint64_t completeAt(int64_t iPos, int iLevel) {
+  if (iPos < 0 || iLevel > MAX_MIP_LOD) return 0;
+  return (uint64_t)(iPos + 1) << iLevel;
+}
+
+// Compute the descriptors for the column at dSamplePos, one per channel at pCol[c*iChannelStride]. The LOD and
+// positions are shared by all channels. Returns the raw sample count from which the column is final.
+__attribute__((always_inline))
+static inline uint64_t setupColumnChannels(SSG* pThis, const RenderView *pView, double dSamplePos, ColumnSpans *pCol, int iChannelStride, int iChannels, int iType) {
+  double dSamplesPerPixel = pView->dSamplesPerPixel;
+  float fZeroAtYPixel = pView->fZeroAtYPixel;
+  float fPixelsPerUnit = pView->fPixelsPerUnit;
+  int iLOD = pView->iLOD;
+  int iHeight = pView->iHeight;
+  int i,m,c;
+
+  double dBaseLodSamplePos = dSamplePos * pView->dLodScale;
+  double dNextLodSamplePos = dBaseLodSamplePos * 0.5 - 0.5;
+
+  int64_t iBaseLodSamplePos = (int64_t)dBaseLodSamplePos;
+  int64_t iNextLodSamplePos = (int64_t)dNextLodSamplePos;
+  float fBaseLodSamplePosFrac = (float)(dBaseLodSamplePos - iBaseLodSamplePos);
+  float fNextLodSamplePosFrac = (float)(dNextLodSamplePos - iNextLodSamplePos);
+
+  if (dSamplesPerPixel < 1.0) {
+    // TODO: Make it filtered? Quite jittery now...
+    float af1[SSG_MAX_CHANNELS], af2[SSG_MAX_CHANNELS];
+    getSamples(pThis, pView->iLength, pView->iColdLength, (int64_t)(dSamplePos - dSamplesPerPixel), 0, af1, af1, iChannels, iType);
+    getSamples(pThis, pView->iLength, pView->iColdLength, (int64_t) dSamplePos                    , 0, af2, af2, iChannels, iType);
+    for (c = 0; c < iChannels; c++) {
+      ColumnSpans *pChannel = &pCol[c*iChannelStride];
+      float v1 = fZeroAtYPixel - fPixelsPerUnit * af1[c];
+      float v2 = fZeroAtYPixel - fPixelsPerUnit * af2[c];
+      setSpan(pChannel, 0, MIN(v1,v2), MAX(v1,v2), iHeight);
+      for (i = 1; i < 4; i++) setSpan(pChannel, i, 1.0f, 0.0f, iHeight);
+      for (m = 0; m < 16; m++) pChannel->aiLut[m] = (uint8_t)((m & 1) ? 255 : 0);
+    }
+    return completeAt((int64_t)dSamplePos, 0);
+  } else {
+    float afBaseMin[3][SSG_MAX_CHANNELS], afBaseMax[3][SSG_MAX_CHANNELS];
+    float afNextMin[3][SSG_MAX_CHANNELS], afNextMax[3][SSG_MAX_CHANNELS];
+    uint8_t aiLut[16];
+    for (i = 0; i < 3; i++) {
+      getSamples(pThis, pView->iLength, pView->iColdLength, iBaseLodSamplePos + i, iLOD    , afBaseMin[i], afBaseMax[i], iChannels, iType);
+      getSamples(pThis, pView->iLength, pView->iColdLength, iNextLodSamplePos + i, iLOD + 1, afNextMin[i], afNextMax[i], iChannels, iType);
+    }
+
+    // A pixel only depends on which of the four intervals cover it, so blend all 16 combinations once per column
+    for (m = 0; m < 16; m++) {
+      int iv0 = linear((m>>0) & 1, (m>>1) & 1, fBaseLodSamplePosFrac);
+      int iv1 = linear((m>>2) & 1, (m>>3) & 1, fNextLodSamplePosFrac);
+
+      uint8_t iv = (uint8_t)(iv0 + (iv1 - iv0) * pView->fFracLod); // TODO: Bad with float->int->float->int.
+      aiLut[m] = pThis->aiGammaxlat[iv];
+    }
+
+    for (c = 0; c < iChannels; c++) {
+      ColumnSpans *pChannel = &pCol[c*iChannelStride];
+      float afBase[3][2], afNext[3][2];
+      for (i = 0; i < 3; i++) {
+        afBase[i][0] = fZeroAtYPixel - fPixelsPerUnit * afBaseMin[i][c];
+        afBase[i][1] = fZeroAtYPixel - fPixelsPerUnit * afBaseMax[i][c];
+        afNext[i][0] = fZeroAtYPixel - fPixelsPerUnit * afNextMin[i][c];
+        afNext[i][1] = fZeroAtYPixel - fPixelsPerUnit * afNextMax[i][c];
+      }
+      setSpan(pChannel, 0, MIN(afBase[0][1],afBase[1][0]), MAX(afBase[0][0],afBase[1][1]), iHeight);
+      setSpan(pChannel, 1, MIN(afBase[1][1],afBase[2][0]), MAX(afBase[1][0],afBase[2][1]), iHeight);
+      setSpan(pChannel, 2, MIN(afNext[0][1],afNext[1][0]), MAX(afNext[0][0],afNext[1][1]), iHeight);
+      setSpan(pChannel, 3, MIN(afNext[1][1],afNext[2][0]), MAX(afNext[1][0],afNext[2][1]), iHeight);
+      memcpy(pChannel->aiLut, aiLut, sizeof(aiLut));
+    }
+    return MAX(completeAt(iBaseLodSamplePos + 2, iLOD), completeAt(iNextLodSamplePos + 2, iLOD + 1));
+  }
+}
+
+__attribute__((always_inline))
+static inline uint64_t setupColumnType(SSG* pThis, const RenderView *pView, double dSamplePos, ColumnSpans *pCol, int iChannelStride, int iType) {
+  if (pThis->iChannels == 1) return setupColumnChannels(pThis, pView, dSamplePos, pCol, iChannelStride, 1, iType);
+  return setupColumnChannels(pThis, pView, dSamplePos, pCol, iChannelStride, pThis->iChannels, iType);
+}
+static uint64_t setupColumn(SSG* pThis, const RenderView *pView, double dSamplePos, ColumnSpans *pCol, int iChannelStride) {
+  switch (pThis->iSampleType) {
+    case SSG_SAMPLE_INT8:   return setupColumnType(pThis, pView, dSamplePos, pCol, iChannelStride, SSG_SAMPLE_INT8);
+    case SSG_SAMPLE_INT16:  return setupColumnType(pThis, pView, dSamplePos, pCol, iChannelStride, SSG_SAMPLE_INT16);
+    case SSG_SAMPLE_HALF:   return setupColumnType(pThis, pView, dSamplePos, pCol, iChannelStride, SSG_SAMPLE_HALF);
+    case SSG_SAMPLE_DOUBLE: return setupColumnType(pThis, pView, dSamplePos, pCol, iChannelStride, SSG_SAMPLE_DOUBLE);
+    default:                return setupColumnType(pThis, pView, dSamplePos, pCol, iChannelStride, SSG_SAMPLE_FLOAT);
+  }
+}
+
+// Compute descriptors for iColumns columns, the first one at dSamplePos. Channel c of column x goes to
+// pColumns[c*iChannelStride + x].
+static void setupColumns(SSG* pThis, const RenderView *pView, double dSamplePos, ColumnSpans *pColumns, int iColumns, int iChannelStride) {
+  int x;
+  for (x=0; x<iColumns; x++) {
+    setupColumn(pThis, pView, dSamplePos, &pColumns[x], iChannelStride);
+    dSamplePos += pView->dSamplesPerPixel;
+  }
+}
+
+// Value range a column covers, in stored units, per channel. The same reads and blend weights as
+// setupColumnChannels, applied to the interval ends instead of the pixel values.
+__attribute__((always_inline))
+static inline void envelopeColumnChannels(SSG* pThis, const RenderView *pView, double dSamplePos, float *pfMin, float *pfMax, int iChannels, int iType) {
+  int i,c;
+
+  double dBaseLodSamplePos = dSamplePos * pView->dLodScale;
+  double dNextLodSamplePos = dBaseLodSamplePos * 0.5 - 0.5;
+
+  int64_t iBaseLodSamplePos = (int64_t)dBaseLodSamplePos;
+  int64_t iNextLodSamplePos = (int64_t)dNextLodSamplePos;
+  float fBaseLodSamplePosFrac = (float)(dBaseLodSamplePos - iBaseLodSamplePos);
+  float fNextLodSamplePosFrac = (float)(dNextLodSamplePos - iNextLodSamplePos);
+
+  if (pView->dSamplesPerPixel < 1.0) {
+    float af1[SSG_MAX_CHANNELS], af2[SSG_MAX_CHANNELS];
+    getSamples(pThis, pView->iLength, pView->iColdLength, (int64_t)(dSamplePos - pView->dSamplesPerPixel), 0, af1, af1, iChannels, iType);
+    getSamples(pThis, pView->iLength, pView->iColdLength, (int64_t) dSamplePos                            , 0, af2, af2, iChannels, iType);
+    for (c = 0; c < iChannels; c++) {
+      pfMin[c] = MIN(af1[c], af2[c]);
+      pfMax[c] = MAX(af1[c], af2[c]);
+    }
+  } else {
+    float afBaseMin[3][SSG_MAX_CHANNELS], afBaseMax[3][SSG_MAX_CHANNELS];
+    float afNextMin[3][SSG_MAX_CHANNELS], afNextMax[3][SSG_MAX_CHANNELS];
+    for (i = 0; i < 3; i++) {
+      getSamples(pThis, pView->iLength, pView->iColdLength, iBaseLodSamplePos + i, pView->iLOD    , afBaseMin[i], afBaseMax[i], iChannels, iType);
+      getSamples(pThis, pView->iLength, pView->iColdLength, iNextLodSamplePos + i, pView->iLOD + 1, afNextMin[i], afNextMax[i], iChannels, iType);
+    }
+    for (c = 0; c < iChannels; c++) {
+      // Each interval is an entry's range stretched to reach the next entry, the pair is blended by the position
+      float fBaseMin = MIN(afBaseMin[0][c], afBaseMax[1][c]);
+      float fBaseMax = MAX(afBaseMax[0][c], afBaseMin[1][c]);
+      float fNextMin = MIN(afNextMin[0][c], afNextMax[1][c]);
+      float fNextMax = MAX(afNextMax[0][c], afNextMin[1][c]);
+      fBaseMin += (MIN(afBaseMin[1][c], afBaseMax[2][c]) - fBaseMin) * fBaseLodSamplePosFrac;
+      fBaseMax += (MAX(afBaseMax[1][c], afBaseMin[2][c]) - fBaseMax) * fBaseLodSamplePosFrac;
+      fNextMin += (MIN(afNextMin[1][c], afNextMax[2][c]) - fNextMin) * fNextLodSamplePosFrac;
+      fNextMax += (MAX(afNextMax[1][c], afNextMin[2][c]) - fNextMax) * fNextLodSamplePosFrac;
+      pfMin[c] = fBaseMin + (fNextMin - fBaseMin) * pView->fFracLod;
+      pfMax[c] = fBaseMax + (fNextMax - fBaseMax) * pView->fFracLod;
+    }
+  }
+}
+__attribute__((always_inline))
+static inline void envelopeColumnsType(SSG* pThis, const RenderView *pView, double dSamplePos, float *pfOutMin, float *pfOutMax, int iWidth, int iType) {
+  float afMin[SSG_MAX_CHANNELS], afMax[SSG_MAX_CHANNELS];
+  int x, c;
+  for (x=0; x<iWidth; x++) {
+    if (pThis->iChannels == 1) {
+      envelopeColumnChannels(pThis, pView, dSamplePos, &pfOutMin[x], &pfOutMax[x], 1, iType);
+    } else {
+      envelopeColumnChannels(pThis, pView, dSamplePos, afMin, afMax, pThis->iChannels, iType);
+      for (c = 0; c < pThis->iChannels; c++) {
+        pfOutMin[(size_t)c*iWidth + x] = afMin[c];
+        pfOutMax[(size_t)c*iWidth + x] = afMax[c];
+      }
+    }
+    dSamplePos += pView->dSamplesPerPixel;
+  }
+}
+
+#ifdef HAVE_SSE2_RASTERIZER
+// 16x16 byte transpose, four rounds of interleaving row i with row i+8
+static void transposeBlockSSE2(const uint8_t *pSrc, size_t iSrcStride, uint8_t *pDst, size_t iDstStride) {
+  __m128i a[16], b[16];
+  int i, iRound;
+  for (i = 0; i < 16; i++) a[i] = _mm_loadu_si128((const __m128i*)(pSrc + i*iSrcStride));
+  for (iRound = 0; iRound < 4; iRound++) {
+    for (i = 0; i < 8; i++) {
+      b[2*i]   = _mm_unpacklo_epi8(a[i], a[i+8]);
+      b[2*i+1] = _mm_unpackhi_epi8(a[i], a[i+8]);
+    }
+    memcpy(a, b, sizeof(a));
+  }
+  for (i = 0; i < 16; i++) _mm_storeu_si128((__m128i*)(pDst + i*iDstStride), a[i]);
+}
+#endif
+
+typedef struct {
+  SSG *pThis;
+  const RenderView *pView;
+  const double *pdBandSamplePos; // sample pos at the first column of each band, NULL if the columns are set up
+  ColumnSpans *pColumns;         // channel c of column x at pColumns[c*iWidth + x]
+  int iLayout;
+  uint8_t *pDstBuffer;
+  int iWidth;
+  int iHeight;
+} TiledRender;
+
+// Transpose a column-major tile of iColumns columns into the destination at column x0, in blocks
+static void storeTile(const uint8_t *pTile, int iColumns, int iHeight, uint8_t *pDstBuffer, int iWidth, int x0) {
+  int c, y, cb, yb;
+  for (yb = 0; yb < iHeight; yb += TRANSPOSE_BLOCK) {
+    int iRows = MIN(TRANSPOSE_BLOCK, iHeight - yb);
+    for (cb = 0; cb < iColumns; cb += TRANSPOSE_BLOCK) {
+      int iCols = MIN(TRANSPOSE_BLOCK, iColumns - cb);
+      const uint8_t *pSrcBlock = pTile + (size_t)cb*iHeight + yb;
+      uint8_t *pDstBlock = pDstBuffer + (size_t)yb*iWidth + x0 + cb;
+#ifdef HAVE_SSE2_RASTERIZER
+      if (iRows == TRANSPOSE_BLOCK && iCols == TRANSPOSE_BLOCK) {
+        transposeBlockSSE2(pSrcBlock, iHeight, pDstBlock, iWidth);
+        continue;
+      }
+#endif
+      for (y = 0; y < iRows; y++) {
+        for (c = 0; c < iCols; c++) {
+          pDstBlock[(size_t)y*iWidth + c] = pSrcBlock[(size_t)c*iHeight + y];
+        }
+      }
+    }
+  }
+}
+
+// Render one band of columns into a column-major tile, then transpose it into the destination
+static void renderBand(void *pArg, int iBand) {
+  TiledRender *pJob = pArg;
+  int iChannels = pJob->pThis->iChannels;
+  int iHeight = pJob->iHeight;
+  int iLaneHeight = pJob->pView->iHeight;
+  int x0 = iBand * RENDER_BAND_WIDTH;
+  int iColumns = MIN(RENDER_BAND_WIDTH, pJob->iWidth - x0);
+  ColumnSpans *pColumns = pJob->pColumns + x0;
+  uint8_t *pTile = malloc((size_t)iColumns * iHeight);
+  int c, ch;
+
+  if (pTile == NULL) return;
+  if (pJob->pdBandSamplePos != NULL) {
+    setupColumns(pJob->pThis, pJob->pView, pJob->pdBandSamplePos[iBand], pColumns, iColumns, pJob->iWidth);
+  }
+  for (c = 0; c < iColumns; c++) {
+    uint8_t *pTileColumn = pTile + (size_t)c*iHeight;
+    if (pJob->iLayout == SSG_LAYOUT_STACKED) {
+      for (ch = 0; ch < iChannels; ch++) {
+        rasterizeColumnScalar(&pColumns[ch*pJob->iWidth + c], pTileColumn + ch*iLaneHeight, 1, iLaneHeight);
+      }
+      memset(pTileColumn + iChannels*iLaneHeight, 0, iHeight - iChannels*iLaneHeight);
+    } else {
+      rasterizeColumnScalar(&pColumns[c], pTileColumn, 1, iHeight);
+      for (ch = 1; ch < iChannels; ch++) {
+        rasterizeColumnMax(&pColumns[ch*pJob->iWidth + c], pTileColumn, iHeight);
+      }
+    }
+  }
+  storeTile(pTile, iColumns, iHeight, pJob->pDstBuffer, pJob->iWidth, x0);
+  free(pTile);
+}
+
+void SSG_RenderChannels(SSG* pThis, double dLeftmostPixelSamplePos, double dRightmostPixelSamplePos, float fTopmostValue, float fBottommostValue, int iLayout, uint8_t *pDstBuffer, int iWidth, int iHeight) {
+  int iLaneHeight = (iLayout == SSG_LAYOUT_STACKED) ? iHeight / pThis->iChannels : iHeight;
+  int iBands = (iWidth + RENDER_BAND_WIDTH - 1) / RENDER_BAND_WIDTH;
+  double dSamplePos;
+  double *pdBandSamplePos;
+  ColumnSpans *pColumns;
+  RenderView view;
+  RenderStats stats;
+  int x;
+
+  if (iLaneHeight < 1) {
+    memset(pDstBuffer, 0, (size_t)iWidth * iHeight);
+    return;
+  }
+  renderStatsBegin(pThis, &stats);
+  pColumns = malloc((size_t)iWidth * pThis->iChannels * sizeof(ColumnSpans));
+  pdBandSamplePos = malloc(iBands * sizeof(double));
+  view.iAttempts = 0;
+  do {
+    setupView(pThis, &view, dLeftmostPixelSamplePos, dRightmostPixelSamplePos, fTopmostValue, fBottommostValue, iWidth, iLaneHeight);
+    if (pColumns == NULL || pdBandSamplePos == NULL) continue;
+    TiledRender job = { pThis, &view, pdBandSamplePos, pColumns, iLayout, pDstBuffer, iWidth, iHeight };
+    // Step the position column by column like the serial path does, to land on the same doubles
+    dSamplePos = dLeftmostPixelSamplePos;
+    for (x = 0; x < iWidth; x++) {
+      if (x % RENDER_BAND_WIDTH == 0) pdBandSamplePos[x / RENDER_BAND_WIDTH] = dSamplePos;
+      dSamplePos += view.dSamplesPerPixel;
+    }
+    if (pThis->pWorkerPool != NULL) {
+      runTasks(pThis->pWorkerPool, renderBand, &job, iBands);
+    } else if (iLayout == SSG_LAYOUT_STACKED) {
+      // Lanes don't overlap, so each can go straight through the row-major rasterizer
+      setupColumns(pThis, &view, dLeftmostPixelSamplePos, pColumns, iWidth, iWidth);
+      for (x = 0; x < pThis->iChannels; x++) {
+        rasterizeColumns(pColumns + (size_t)x*iWidth, iWidth, pDstBuffer + (size_t)x*iLaneHeight*iWidth, iWidth, iLaneHeight);
+      }
+      memset(pDstBuffer + (size_t)pThis->iChannels*iLaneHeight*iWidth, 0, (size_t)(iHeight - pThis->iChannels*iLaneHeight)*iWidth);
+    } else {
+      for (x = 0; x < iBands; x++) renderBand(&job, x);
+    }
+  } while (!finishView(pThis, &view));
+  free(pdBandSamplePos);
+  free(pColumns);
+  hintView(pThis, dLeftmostPixelSamplePos, dRightmostPixelSamplePos, view.iLOD);
+  renderStatsEnd(pThis, &stats, view.iLOD, iWidth);
+}
+
+void SSG_Render(SSG* pThis, double dLeftmostPixelSamplePos, double dRightmostPixelSamplePos, float fTopmostValue, float fBottommostValue, uint8_t *pDstBuffer, int iWidth, int iHeight) {
+  RenderView view;
+  RenderStats stats;
+  ColumnSpans *pColumns;
+
+  if (pThis->pWorkerPool != NULL || pThis->iChannels > 1) {
+    SSG_RenderChannels(pThis, dLeftmostPixelSamplePos, dRightmostPixelSamplePos, fTopmostValue, fBottommostValue, SSG_LAYOUT_OVERLAID, pDstBuffer, iWidth, iHeight);
+    return;
+  }
+  renderStatsBegin(pThis, &stats);
+  pColumns = malloc(iWidth * sizeof(ColumnSpans));
+  view.iAttempts = 0;
+  do {
+    setupView(pThis, &view, dLeftmostPixelSamplePos, dRightmostPixelSamplePos, fTopmostValue, fBottommostValue, iWidth, iHeight);
+    if (pColumns != NULL) {
+      setupColumns(pThis, &view, dLeftmostPixelSamplePos, pColumns, iWidth, 0);
+      rasterizeColumns(pColumns, iWidth, pDstBuffer, iWidth, iHeight);
+    }
+  } while (!finishView(pThis, &view));
+  free(pColumns);
+  hintView(pThis, dLeftmostPixelSamplePos, dRightmostPixelSamplePos, view.iLOD);
+  renderStatsEnd(pThis, &stats, view.iLOD, iWidth);
+}
+
+void SSG_RenderEnvelope(SSG* pThis, double dLeftmostPixelSamplePos, double dRightmostPixelSamplePos, int iWidth, float *pfOutMin, float *pfOutMax) {
+  RenderView view;
+  RenderStats stats;
+  size_t i;
+
+  renderStatsBegin(pThis, &stats);
+  view.iAttempts = 0;
+  do {
+    // Only the LOD and sample positions of the view are used, the value range doesn't matter
+    setupView(pThis, &view, dLeftmostPixelSamplePos, dRightmostPixelSamplePos, 1.0f, 0.0f, iWidth, 1);
+    switch (pThis->iSampleType) {
+      case SSG_SAMPLE_INT8:   envelopeColumnsType(pThis, &view, dLeftmostPixelSamplePos, pfOutMin, pfOutMax, iWidth, SSG_SAMPLE_INT8);   break;
+      case SSG_SAMPLE_INT16:  envelopeColumnsType(pThis, &view, dLeftmostPixelSamplePos, pfOutMin, pfOutMax, iWidth, SSG_SAMPLE_INT16);  break;
+      case SSG_SAMPLE_HALF:   envelopeColumnsType(pThis, &view, dLeftmostPixelSamplePos, pfOutMin, pfOutMax, iWidth, SSG_SAMPLE_HALF);   break;
+      case SSG_SAMPLE_DOUBLE: envelopeColumnsType(pThis, &view, dLeftmostPixelSamplePos, pfOutMin, pfOutMax, iWidth, SSG_SAMPLE_DOUBLE); break;
+      default:                envelopeColumnsType(pThis, &view, dLeftmostPixelSamplePos, pfOutMin, pfOutMax, iWidth, SSG_SAMPLE_FLOAT);  break;
+    }
+  } while (!finishView(pThis, &view));
+  hintView(pThis, dLeftmostPixelSamplePos, dRightmostPixelSamplePos, view.iLOD);
+  if (pThis->fScale != 1.0f || pThis->fOffset != 0.0f) {
+    for (i = 0; i < (size_t)iWidth * pThis->iChannels; i++) {
+      pfOutMin[i] = pfOutMin[i] * pThis->fScale + pThis->fOffset;
+      pfOutMax[i] = pfOutMax[i] * pThis->fScale + pThis->fOffset;
+    }
+  }
+  renderStatsEnd(pThis, &stats, view.iLOD, iWidth);
+}
+
+// Value of every channel at time iTime between frames iIndex-1 and iIndex, on the line between them. Returns 0 if
+// there is no such pair or they are more than iMaxGap apart.
+static int interpolateAt(SSG *pThis, const RenderView *pView, uint64_t iIndex, int64_t iTime, int64_t iMaxGap, SampleValue *pvValue) {
+  SampleValue avPrev[SSG_MAX_CHANNELS], avNext[SSG_MAX_CHANNELS], avUnused[SSG_MAX_CHANNELS];
+  int c;
+  if (iIndex <= retainedStart(pThis, pView->iLength) || iIndex >= pView->iLength) return 0;
+  int64_t t0 = frameTime(pThis, iIndex - 1), t1 = frameTime(pThis, iIndex);
+  if ((uint64_t)t1 - (uint64_t)t0 > (uint64_t)iMaxGap) return 0;
+  double f = (t1 > t0) ? (double)((uint64_t)iTime - (uint64_t)t0) / (double)((uint64_t)t1 - (uint64_t)t0) : 0.0;
+  queryRange(pThis, pView->iLength, pView->iColdLength, iIndex - 1, iIndex, avPrev, avUnused);
+  queryRange(pThis, pView->iLength, pView->iColdLength, iIndex, iIndex + 1, avNext, avUnused);
+  for (c = 0; c < pThis->iChannels; c++) pvValue[c] = avPrev[c] + (avNext[c] - avPrev[c]) * f;
+  return 1;
+}
+// Descriptors for the column covering times [iFrom, iTo), which holds frames [iFirst, iEnd). The column spans the
+// samples in it and the lines to the neighbouring samples up to its edges. Lines are only drawn over gaps of at
+// most iMaxGap, so an empty column in a longer gap stays empty.
+static void setupTimeColumn(SSG *pThis, const RenderView *pView, int64_t iFrom, int64_t iTo, uint64_t iFirst, uint64_t iEnd, int64_t iMaxGap, ColumnSpans *pCol, int iChannelStride) {
+  SampleValue avMin[SSG_MAX_CHANNELS], avMax[SSG_MAX_CHANNELS], avEdge[SSG_MAX_CHANNELS];
+  int c, m;
+
+  if (iEnd > iFirst) {
+    queryRange(pThis, pView->iLength, pView->iColdLength, iFirst, iEnd, avMin, avMax);
+  } else {
+    for (c = 0; c < pThis->iChannels; c++) {
+      avMin[c] = INFINITY;
+      avMax[c] = -INFINITY;
+    }
+  }
+  if (interpolateAt(pThis, pView, iFirst, iFrom, iMaxGap, avEdge)) {
+    for (c = 0; c < pThis->iChannels; c++) {
+      avMin[c] = MIN(avMin[c], avEdge[c]);
+      avMax[c] = MAX(avMax[c], avEdge[c]);
+    }
+  }
+  if (interpolateAt(pThis, pView, iEnd, iTo, iMaxGap, avEdge)) {
+    for (c = 0; c < pThis->iChannels; c++) {
+      avMin[c] = MIN(avMin[c], avEdge[c]);
+      avMax[c] = MAX(avMax[c], avEdge[c]);
+    }
+  }
+  for (c = 0; c < pThis->iChannels; c++) {
+    ColumnSpans *pChannel = &pCol[c*iChannelStride];
+    if (avMin[c] <= avMax[c]) {
+      float fLo = pView->fZeroAtYPixel - pView->fPixelsPerUnit * (float)avMax[c];
+      float fHi = pView->fZeroAtYPixel - pView->fPixelsPerUnit * (float)avMin[c];
+      setSpan(pChannel, 0, fLo, fHi, pView->iHeight);
+    } else {
+      setSpan(pChannel, 0, 1.0f, 0.0f, pView->iHeight);
+    }
+    for (m = 1; m < 4; m++) setSpan(pChannel, m, 1.0f, 0.0f, pView->iHeight);
+    for (m = 0; m < 16; m++) pChannel->aiLut[m] = (uint8_t)((m & 1) ? 255 : 0);
+  }
+}
+
+void SSG_RenderTime(SSG* pThis, int64_t iLeftmostPixelTime, int64_t iRightmostPixelTime, float fTopmostValue, float fBottommostValue, int64_t iMaxGap, uint8_t *pDstBuffer, int iWidth, int iHeight) {
+  double dTimePerPixel = ((double)iRightmostPixelTime - (double)iLeftmostPixelTime) / (double)iWidth;
+  RenderView view;
+  RenderStats stats;
+  ColumnSpans *pColumns;
+  int64_t *piTime;
+  uint64_t *piFirst;
+  int x, iBands = (iWidth + RENDER_BAND_WIDTH - 1) / RENDER_BAND_WIDTH;
+
+  renderStatsBegin(pThis, &stats);
+  pColumns = malloc((size_t)iWidth * pThis->iChannels * sizeof(ColumnSpans));
+  piTime = malloc((iWidth + 1) * sizeof(int64_t));
+  piFirst = malloc((iWidth + 1) * sizeof(uint64_t));
+  view.iAttempts = 0;
+  do {
+    // Only the value mapping and the snapshot of the view are used, columns are placed by time
+    setupView(pThis, &view, 0.0, (double)iWidth, fTopmostValue, fBottommostValue, iWidth, iHeight);
+    if (pColumns == NULL || piTime == NULL || piFirst == NULL) continue;
+    // Column x covers [piTime[x], piTime[x+1]) and frames [piFirst[x], piFirst[x+1])
+    for (x = 0; x <= iWidth; x++) {
+      piTime[x] = iLeftmostPixelTime + (int64_t)floor(x * dTimePerPixel);
+      piFirst[x] = timeLowerBound(pThis, view.iLength, piTime[x]);
+    }
+    for (x = 0; x < iWidth; x++) {
+      setupTimeColumn(pThis, &view, piTime[x], piTime[x+1], piFirst[x], piFirst[x+1], iMaxGap, &pColumns[x], iWidth);
+    }
+    double dSamplesPerPixel = (double)(piFirst[iWidth] - piFirst[0]) / iWidth;
+    view.iLOD = dSamplesPerPixel > 1.0 ? (int)(log(dSamplesPerPixel) / log(2.0)) : 0;
+    hintView(pThis, (double)piFirst[0], (double)piFirst[iWidth], view.iLOD);
+
+    TiledRender job = { pThis, &view, NULL, pColumns, SSG_LAYOUT_OVERLAID, pDstBuffer, iWidth, iHeight };
+    if (pThis->pWorkerPool != NULL) {
+      runTasks(pThis->pWorkerPool, renderBand, &job, iBands);
+    } else if (pThis->iChannels == 1) {
+      rasterizeColumns(pColumns, iWidth, pDstBuffer, iWidth, iHeight);
+    } else {
+      for (x = 0; x < iBands; x++) renderBand(&job, x);
+    }
+  } while (!finishView(pThis, &view));
+  free(piFirst);
+  free(piTime);
+  free(pColumns);
+  renderStatsEnd(pThis, &stats, view.iLOD, iWidth);
+}
+
+/*
+ * Density
+ *
+ * SSG_RenderDensity shades each pixel by the share of its column's samples that fall into its row, like the
+ * persistence of an oscilloscope, so a busy signal shows where it spends its time rather than a solid band from
+ * min to max. Every stretch of samples a column reads is spread evenly over a value range: a raw frame over the
+ * line to the next one, a level entry over its min/max. Graphs created with bDensity also keep the moments of
+ * every entry of the levels from 2^iMomentLog2 raw frames up, the mean of its raw values and M2, their summed
+ * squared deviations from it. The first of these levels takes them from the raw frames, each one above combines
+ * those of the level below, like the min/max. Kept centred per entry, they stay exact to rounding however long the
+ * series or large its offset, and an edit only recomputes the entries over it. The entry is then spread like a
+ * uniform distribution with that mean and variance, clipped to its min/max. A column reads DENSITY_ENTRIES or more entries of the coarsest level that has as many, so a render reads
+ * about as much at any zoom, and raw frames only when zoomed in that far.
+ */
+
+// Log2 of the raw frames per entry the columns read, 0 for raw frames
+static int densityShift(SSG *pThis, double dSamplesPerPixel) {
+  int iStep = pThis->iFanoutLog2;
+  int iShift = (pThis->iMomentLog2 != 0) ? pThis->iMomentLog2 : iStep;
+  if (dSamplesPerPixel < ldexp(DENSITY_ENTRIES, iShift)) return 0;
+  while (iShift + iStep <= pThis->iLevels * iStep && dSamplesPerPixel >= ldexp(DENSITY_ENTRIES, iShift + iStep)) {
+    iShift += iStep;
+  }
+  return iShift;
+}
+// Add fMass spread evenly over rows [fLo, fHi] of a column, dropping what lies outside [0, iHeight). The rows
+// fully covered go into the difference array pfSlope, of iHeight+1 entries, so a tall range costs four writes.
+static void addDensity(float *pfRows, float *pfSlope, float fLo, float fHi, float fMass, int iHeight) {
+  if (fHi - fLo < 1.0f / 256) {
+    if (fLo >= 0.0f && fLo < (float)iHeight) pfRows[(int)fLo] += fMass;
+    return;
+  }
+  float fDensity = fMass / (fHi - fLo);
+  fLo = MAX(fLo, 0.0f);
+  fHi = MIN(fHi, (float)iHeight);
+  if (!(fLo < fHi)) return;
+  int y0 = (int)fLo, y1 = (int)fHi;
+  if (y0 == y1) {
+    pfRows[y0] += fDensity * (fHi - fLo);
+    return;
+  }
+  pfRows[y0] += fDensity * ((float)(y0 + 1) - fLo);
+  if (y1 < iHeight) pfRows[y1] += fDensity * (fHi - (float)y1);
+  pfSlope[y0 + 1] += fDensity;
+  pfSlope[y1] -= fDensity;
+}
+// iCount raw frames from iFirst, below the view's length, as floats in stored units with the channels interleaved
+static void readFrames(SSG *pThis, const RenderView *pView, uint64_t iFirst, int iCount, float *pfValues) {
+  int iChannels = pThis->iChannels;
+  int i;
+  while (iCount > 0) {
+    int iRun;
+    if (iFirst < pView->iColdLength) {
+      iRun = (int)MIN((uint64_t)iCount, (((iFirst >> COLD_BLOCK_LOG2) + 1) << COLD_BLOCK_LOG2) - iFirst);
+      pthread_mutex_lock(&pThis->coldLock);
+      const uint8_t *pFrames = cachedColdBlock(pThis, iFirst >> COLD_BLOCK_LOG2);
+      for (i = 0; i < iRun*iChannels; i++) {
+        pfValues[i] = (pFrames != NULL) ? loadFloat(pFrames + (iFirst & ((1 << COLD_BLOCK_LOG2) - 1)) * pThis->samples.iEntrySize, i, pThis->iSampleType) : 0.0f;
+      }
+      pthread_mutex_unlock(&pThis->coldLock);
+    } else {
+      iRun = (int)MIN((uint64_t)iCount, bufferRun(&pThis->samples, iFirst));
+      const void *pEntry = entryPtr(&pThis->samples, iFirst);
+      for (i = 0; i < iRun*iChannels; i++) pfValues[i] = loadFloat(pEntry, i, pThis->iSampleType);
+    }
+    pfValues += iRun*iChannels;
+    iFirst += iRun;
+    iCount -= iRun;
+  }
+}
+// Density of raw samples [dFrom, dTo), each spread over the line to the next frame. pfScratch holds
+// DENSITY_RAW_CHUNK+1 frames.
+static void densityFrames(SSG *pThis, const RenderView *pView, double dFrom, double dTo, float *pfScratch, float *pfRows, float *pfSlope) {
+  int iChannels = pThis->iChannels, iHeight = pView->iHeight;
+  uint64_t i = (uint64_t)dFrom, iEnd = (uint64_t)ceil(dTo);
+  int j, c;
+  while (i < iEnd) {
+    int iCount = (int)MIN(iEnd - i, DENSITY_RAW_CHUNK);
+    int iRead = (i + iCount < pView->iLength) ? iCount + 1 : iCount;
+    readFrames(pThis, pView, i, iRead, pfScratch);
+    for (j = 0; j < iCount; j++) {
+      float fMass = (float)(MIN(dTo, (double)(i + j + 1)) - MAX(dFrom, (double)(i + j)));
+      for (c = 0; c < iChannels; c++) {
+        float fY0 = pView->fZeroAtYPixel - pView->fPixelsPerUnit * pfScratch[j*iChannels + c];
+        float fY1 = (j + 1 < iRead) ? pView->fZeroAtYPixel - pView->fPixelsPerUnit * pfScratch[(j+1)*iChannels + c] : fY0;
+        addDensity(pfRows + c*(iHeight+1), pfSlope + c*(iHeight+1), MIN(fY0, fY1), MAX(fY0, fY1), fMass, iHeight);
+      }
+    }
+    i += iCount;
+  }
+}
+// Density of raw samples [dFrom, dTo) from the entries of 2^iShift raw frames covering them, all complete and kept
+static void densityEntries(SSG *pThis, const RenderView *pView, double dFrom, double dTo, int iShift, float *pfRows, float *pfSlope) {
+  Buffer *pB = levelBuffer(pThis, iShift / pThis->iFanoutLog2);
+  int iChannels = pThis->iChannels, iHeight = pView->iHeight;
+  Buffer *pMoments = (pThis->iMomentLog2 != 0 && iShift >= pThis->iMomentLog2) ? momentBuffer(pThis, iShift / pThis->iFanoutLog2) : NULL;
+  uint64_t e = (uint64_t)dFrom >> iShift, iEnd = ((uint64_t)ceil(dTo) + ((uint64_t)1 << iShift) - 1) >> iShift;
+  double dEntrySamples = ldexp(1.0, iShift);
+  int c;
+  for (; e < iEnd; e++) {
+    float fMass = (float)(MIN(dTo, (double)((e + 1) << iShift)) - MAX(dFrom, (double)(e << iShift)));
+    const void *pEntry = entryPtr(pB, e);
+    const double *pdMoments = (pMoments != NULL) ? entryPtr(pMoments, e) : NULL;
+    for (c = 0; c < iChannels; c++) {
+      double dMin = loadFloat(pEntry, 2*c, pThis->iSampleType);
+      double dMax = loadFloat(pEntry, 2*c + 1, pThis->iSampleType);
+      if (pdMoments != NULL) {
+        double dMean = pdMoments[2*c];
+        double dHalf = sqrt(3.0 * pdMoments[2*c+1] / dEntrySamples);
+        double dLo = MAX(dMin, dMean - dHalf), dHi = MIN(dMax, dMean + dHalf);
+        if (dLo <= dHi) {
+          dMin = dLo;
+          dMax = dHi;
+        }
+      }
+      // In double, the rows of values far from zero would otherwise round to a fraction of a pixel
+      addDensity(pfRows + c*(iHeight+1), pfSlope + c*(iHeight+1), (float)(pView->fZeroAtYPixel - pView->fPixelsPerUnit * dMax),
+                 (float)(pView->fZeroAtYPixel - pView->fPixelsPerUnit * dMin), fMass, iHeight);
+    }
+  }
+}
+// Density of the column over raw samples [dFrom, dTo): whole kept entries of 2^iShift raw frames where there are
+// any, raw frames for the rest
+static void densityColumn(SSG *pThis, const RenderView *pView, double dFrom, double dTo, int iShift, float *pfScratch, float *pfRows, float *pfSlope) {
+  uint64_t iStart = retainedStart(pThis, pView->iLength);
+  dFrom = MAX(dFrom, (double)iStart);
+  dTo = MIN(dTo, (double)pView->iLength);
+  if (dFrom >= dTo) return;
+  uint64_t iFirst = (iStart + ((uint64_t)1 << iShift) - 1) >> iShift, iEnd = pView->iLength >> iShift;
+  if (iShift == 0 || iFirst >= iEnd) {
+    densityFrames(pThis, pView, dFrom, dTo, pfScratch, pfRows, pfSlope);
+    return;
+  }
+  double dFirst = (double)(iFirst << iShift), dEnd = (double)(iEnd << iShift);
+  if (dFrom < dFirst) densityFrames(pThis, pView, dFrom, MIN(dTo, dFirst), pfScratch, pfRows, pfSlope);
+  if (dFrom < dEnd && dTo > dFirst) densityEntries(pThis, pView, MAX(dFrom, dFirst), MIN(dTo, dEnd), iShift, pfRows, pfSlope);
+  if (dTo > dEnd) densityFrames(pThis, pView, MAX(dFrom, dEnd), dTo, pfScratch, pfRows, pfSlope);
+}
+
+typedef struct {
+  SSG *pThis;
+  const RenderView *pView;
+  double dLeft;  // sample pos at the left edge
+  int iShift;    // see densityShift
+  uint8_t *pDstBuffer;
+  int iWidth;
+  int iHeight;
+} DensityRender;
+
+// Render one band of density columns into a column-major tile, then transpose it into the destination
+static void renderDensityBand(void *pArg, int iBand) {
+  DensityRender *pJob = pArg;
+  SSG *pThis = pJob->pThis;
+  int iChannels = pThis->iChannels, iHeight = pJob->iHeight;
+  int x0 = iBand * RENDER_BAND_WIDTH;
+  int iColumns = MIN(RENDER_BAND_WIDTH, pJob->iWidth - x0);
+  size_t iRowsSize = (size_t)iChannels * (iHeight + 1) * sizeof(float);
+  uint8_t *pTile = malloc((size_t)iColumns * iHeight);
+  float *pfRows = malloc(2 * iRowsSize);
+  float *pfScratch = malloc((size_t)(DENSITY_RAW_CHUNK + 1) * iChannels * sizeof(float));
+  int x, c, y;
+
+  if (pTile != NULL && pfRows != NULL && pfScratch != NULL) {
+    float *pfSlope = pfRows + (size_t)iChannels * (iHeight + 1);
+    for (x = 0; x < iColumns; x++) {
+      uint8_t *pTileColumn = pTile + (size_t)x*iHeight;
+      double dFrom = pJob->dLeft + (x0 + x) * pJob->pView->dSamplesPerPixel;
+      memset(pfRows, 0, 2 * iRowsSize);
+      memset(pTileColumn, 0, iHeight);
+      densityColumn(pThis, pJob->pView, dFrom, dFrom + pJob->pView->dSamplesPerPixel, pJob->iShift, pfScratch, pfRows, pfSlope);
+      for (c = 0; c < iChannels; c++) {
+        float *pfChannel = pfRows + c*(iHeight+1), *pfChannelSlope = pfSlope + c*(iHeight+1);
+        float fRun = 0.0f, fPeak = 0.0f;
+        for (y = 0; y < iHeight; y++) {
+          fRun += pfChannelSlope[y];
+          pfChannel[y] += fRun;
+          fPeak = MAX(fPeak, pfChannel[y]);
+        }
+        if (fPeak <= 0.0f) continue;
+        // Brightness relative to the busiest row, through the gamma of the line renders
+        float fScale = 255.0f / fPeak;
+        for (y = 0; y < iHeight; y++) {
+          int iLevel = MAX(0, MIN(255, (int)(pfChannel[y] * fScale)));
+          pTileColumn[y] = MAX(pTileColumn[y], pThis->aiGammaxlat[iLevel]);
+        }
+      }
+    }
+    storeTile(pTile, iColumns, iHeight, pJob->pDstBuffer, pJob->iWidth, x0);
+  }
+  free(pfScratch);
+  free(pfRows);
+  free(pTile);
+}
+
+void SSG_RenderDensity(SSG* pThis, double dLeftmostPixelSamplePos, double dRightmostPixelSamplePos, float fTopmostValue, float fBottommostValue, uint8_t *pDstBuffer, int iWidth, int iHeight) {
+  int x, iBands = (iWidth + RENDER_BAND_WIDTH - 1) / RENDER_BAND_WIDTH;
+  RenderView view;
+  RenderStats stats;
+
+  renderStatsBegin(pThis, &stats);
+  view.iAttempts = 0;
+  do {
+    setupView(pThis, &view, dLeftmostPixelSamplePos, dRightmostPixelSamplePos, fTopmostValue, fBottommostValue, iWidth, iHeight);
+    DensityRender job = { pThis, &view, dLeftmostPixelSamplePos, densityShift(pThis, view.dSamplesPerPixel), pDstBuffer, iWidth, iHeight };
+    if (pThis->pWorkerPool != NULL) {
+      runTasks(pThis->pWorkerPool, renderDensityBand, &job, iBands);
+    } else {
+      for (x = 0; x < iBands; x++) renderDensityBand(&job, x);
+    }
+  } while (!finishView(pThis, &view));
+  hintView(pThis, dLeftmostPixelSamplePos, dRightmostPixelSamplePos, densityShift(pThis, view.dSamplesPerPixel));
+  renderStatsEnd(pThis, &stats, view.iLOD, iWidth);
+}
+
+void SSG_SetWorkerPool(SSG *pThis, SSG_WorkerPool *pPool) {
+  pThis->pWorkerPool = pPool;
+}
+
+/*
+ * Render cache
+ *
+ * Columns sit on a fixed grid, column n at sample pos n*dSamplesPerPixel, so a column's pixels only depend on n and
+ * on the data it reads. A pan then moves pixels and a zoom or resize starts over. Each column remembers the sample
+ * count from which its reads are complete; appends only redraw the columns that were not. An edit of published
+ * samples redraws everything.
+ */
+
+struct SSG_RenderCache_private {
+  SSG *pGraph;            // graph and destination of the cached frame
+  uint8_t *pDstBuffer;
+  int iWidth;
+  int iHeight;
+  double dSamplesPerPixel;
+  float fTopmostValue;
+  float fBottommostValue;
+  int64_t iFirstColumn;   // grid index of the leftmost column
+  uint64_t iLength;       // graph length the frame was rendered at
+  uint64_t iStart;        // first sample kept at that length, see Retention
+  uint64_t iRewrites;     // edits of the graph the frame has seen, see SSG_SetFrames
+  uint64_t *piCompleteAt; // per column: graph length from which the column is final
+  uint8_t *pbDirty;       // per column: needs rendering this call
+  ColumnSpans *pColumns;
+  int bValid;
+};
+
+SSG_RenderCache *SSG_RenderCacheNew(void) {
+  return calloc(sizeof(SSG_RenderCache), 1);
+}
+
+void SSG_RenderCacheTeardown(SSG_RenderCache *pCache) {
+  free(pCache->piCompleteAt);
+  free(pCache->pbDirty);
+  free(pCache->pColumns);
+  free(pCache);
+}
+
+void SSG_RenderCacheInvalidate(SSG_RenderCache *pCache) {
+  pCache->bValid = 0;
+}
+
+static void shiftCachedColumns(SSG_RenderCache *pCache, int64_t iShift) {
+  int iWidth = pCache->iWidth;
+  int iKeep = iWidth - (int)(iShift < 0 ? -iShift : iShift);
+  int iFrom = iShift > 0 ? (int)iShift : 0;
+  int iTo = iShift > 0 ? 0 : (int)-iShift;
+  int x, y;
+
+  for (y = 0; y < pCache->iHeight; y++) {
+    uint8_t *pRow = pCache->pDstBuffer + (size_t)y*iWidth;
+    memmove(pRow + iTo, pRow + iFrom, iKeep);
+  }
+  memmove(pCache->piCompleteAt + iTo, pCache->piCompleteAt + iFrom, iKeep * sizeof(uint64_t));
+  for (x = 0; x < iWidth; x++) {
+    if (x < iTo || x >= iTo + iKeep) pCache->pbDirty[x] = 1;
+  }
+}
+
+void SSG_RenderCached(SSG* pThis, SSG_RenderCache *pCache, double dLeftmostPixelSamplePos, double dRightmostPixelSamplePos, float fTopmostValue, float fBottommostValue, uint8_t *pDstBuffer, int iWidth, int iHeight) {
+  RenderView view;
+  RenderStats stats;
+  uint64_t iLength, iRewrites;
+  int64_t iFirstColumn;
+  int x, iRun;
+  int iColumns = 0;
+
+  if (pThis->iChannels > 1) {
+    // Columns of several channels are drawn over each other in a tile, the cache only handles one
+    pCache->bValid = 0;
+    SSG_Render(pThis, dLeftmostPixelSamplePos, dRightmostPixelSamplePos, fTopmostValue, fBottommostValue, pDstBuffer, iWidth, iHeight);
+    return;
+  }
+  renderStatsBegin(pThis, &stats);
+  view.iAttempts = 0;
+  do {
+    // An attempt that overlapped an edit may have cached columns from before and after it
+    if (view.iAttempts > 0) pCache->bValid = 0;
+    setupView(pThis, &view, dLeftmostPixelSamplePos, dRightmostPixelSamplePos, fTopmostValue, fBottommostValue, iWidth, iHeight);
+    iLength = view.iLength;
+    iFirstColumn = (int64_t)floor(dLeftmostPixelSamplePos / view.dSamplesPerPixel + 0.5);
+    iRewrites = view.iRewrites;
+
+    if (!pCache->bValid || pCache->pGraph != pThis || pCache->iRewrites != iRewrites || pCache->pDstBuffer != pDstBuffer ||
+        pCache->iWidth != iWidth || pCache->iHeight != iHeight || pCache->dSamplesPerPixel != view.dSamplesPerPixel ||
+        pCache->fTopmostValue != fTopmostValue || pCache->fBottommostValue != fBottommostValue ||
+        llabs(iFirstColumn - pCache->iFirstColumn) >= iWidth) {
+      if (pCache->iWidth != iWidth || pCache->pColumns == NULL) {
+        free(pCache->piCompleteAt);
+        free(pCache->pbDirty);
+        free(pCache->pColumns);
+        pCache->piCompleteAt = malloc(iWidth * sizeof(uint64_t));
+        pCache->pbDirty = malloc(iWidth);
+        pCache->pColumns = malloc(iWidth * sizeof(ColumnSpans));
+        if (pCache->piCompleteAt == NULL || pCache->pbDirty == NULL || pCache->pColumns == NULL) {
+          pCache->bValid = 0;
+          pCache->iWidth = 0;
+          if (!finishView(pThis, &view)) readAbort(pThis, view.iAttempts);
+          return;
+        }
+      }
+      pCache->pGraph = pThis;
+      pCache->pDstBuffer = pDstBuffer;
+      pCache->iWidth = iWidth;
+      pCache->iHeight = iHeight;
+      pCache->dSamplesPerPixel = view.dSamplesPerPixel;
+      pCache->fTopmostValue = fTopmostValue;
+      pCache->fBottommostValue = fBottommostValue;
+      memset(pCache->pbDirty, 1, iWidth);
+    } else {
+      memset(pCache->pbDirty, 0, iWidth);
+      if (iFirstColumn != pCache->iFirstColumn) shiftCachedColumns(pCache, iFirstColumn - pCache->iFirstColumn);
+      if (iLength != pCache->iLength) {
+        for (x = 0; x < iWidth; x++) {
+          if (pCache->piCompleteAt[x] > pCache->iLength) pCache->pbDirty[x] = 1;
+        }
+      }
+      if (retainedStart(pThis, iLength) != pCache->iStart) {
+        // Columns that read samples which were dropped since, with a margin for the coarser level and interpolation
+        double dMargin = 8.0 * MAX(view.dSamplesPerPixel, 1.0);
+        for (x = 0; x < iWidth; x++) {
+          double dPos = (double)(iFirstColumn + x) * view.dSamplesPerPixel;
+          if (dPos + dMargin > (double)pCache->iStart && dPos - dMargin < (double)retainedStart(pThis, iLength)) pCache->pbDirty[x] = 1;
+        }
+      }
+    }
+    pCache->iFirstColumn = iFirstColumn;
+    pCache->iLength = iLength;
+    pCache->iStart = retainedStart(pThis, iLength);
+    pCache->iRewrites = iRewrites;
+    pCache->bValid = 1;
+
+    // Render runs of dirty columns
+    for (x = 0; x < iWidth; x = iRun) {
+      if (!pCache->pbDirty[x]) {
+        iRun = x + 1;
+        continue;
+      }
+      for (iRun = x; iRun < iWidth && pCache->pbDirty[iRun]; iRun++) {
+        pCache->piCompleteAt[iRun] = setupColumn(pThis, &view, (double)(iFirstColumn + iRun) * view.dSamplesPerPixel, &pCache->pColumns[iRun], 0);
+      }
+      rasterizeColumns(pCache->pColumns + x, iRun - x, pDstBuffer + x, iWidth, iHeight);
+      iColumns += iRun - x;
+    }
+  } while (!finishView(pThis, &view));
+  hintView(pThis, dLeftmostPixelSamplePos, dRightmostPixelSamplePos, view.iLOD);
+  renderStatsEnd(pThis, &stats, view.iLOD, iColumns);
 }
@@ -26,44 +26,374 @@ SOFTWARE.
 #define _SUBSAMPLEGRAPH_H
 
 #include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Threads
+ * One thread may add samples (SSG_Add*) while any number of other threads render or read the same SSG object.
+ * Each reading call works on the length published when it started, so a frame never shows a partly added
+ * block, and readers take no locks except a short one when reading raw samples from cold storage. SSG_RebuildLods,
+ * SSG_Teardown and SSG_SetWorkerPool need the readers stopped. SSG_Set* edits, SSG_Flush, SSG_SetAutoFlush and
+ * SSG_SetColdStorage are writer calls. An edit doesn't wait for reading calls, and one that overlaps an edit reads
+ * again, so it sees all of the edit or none. SSG_Prefetch and SSG_SetPrefetch may be called from any thread.
+ */
 
 typedef struct SSG_private SSG;
+typedef struct SSG_WorkerPool_private SSG_WorkerPool;
+typedef struct SSG_RenderCache_private SSG_RenderCache;
+
+#define SSG_MAX_CHANNELS 64
+
+// Layouts for SSG_RenderChannels
+#define SSG_LAYOUT_OVERLAID 0 // all channels over the full height, the brighter pixel wins
+#define SSG_LAYOUT_STACKED  1 // channel c in lane c of height/channels rows, channel 0 at the top
+
+// Sample types for SSG_Options, used for the raw samples and the LOD levels
+#define SSG_SAMPLE_FLOAT  0
+#define SSG_SAMPLE_INT8   1
+#define SSG_SAMPLE_INT16  2
+#define SSG_SAMPLE_HALF   3 // IEEE 754 binary16
+#define SSG_SAMPLE_DOUBLE 4
+
+// Entries of the per-level arrays in SSG_Stats
+#define SSG_STATS_LEVELS 63
+
+/**
+ * SSG_Stats
+ * Runtime statistics, see SSG_GetStats. The counters cover the time since statistics were last enabled, the
+ * sizes are always current. Times are in seconds.
+ */
+typedef struct {
+  uint64_t iSamples;                                // samples in the graph
+  uint64_t iSamplesAdded;                           // samples added since the graph was opened
+  int iLevels;                                      // used entries of the level arrays, raw samples first
+  uint64_t aiLevelBytes[SSG_STATS_LEVELS];          // bytes holding data, per level
+  uint64_t aiLevelAllocatedBytes[SSG_STATS_LEVELS]; // bytes of the extents allocated in the file, per level
+  uint64_t iBytesMapped;                            // address space mapped, including windows ahead of the file end
+  uint64_t iFileBytes;                              // file size, including space allocated ahead
+  uint64_t iMaps;                                   // windows mapped
+  double dMapSeconds;
+  uint64_t iFileGrowths;                            // times the file was extended
+  double dFileGrowthSeconds;
+  uint64_t iSyncs;                                  // SSG_Flush calls and commits, see SSG_SetAutoFlush
+  double dSyncSeconds;
+  uint64_t iRenders;                                // SSG_Render* calls
+  double dRenderSeconds;
+  double dMaxRenderSeconds;                         // the slowest render
+  uint64_t iColumnsRendered;                        // columns drawn, less than the width when SSG_RenderCached reuses columns
+  int iLastLod;                                     // LOD of the last render, 0 for raw samples, one step per 2:1
+  uint64_t aiRendersPerLod[SSG_STATS_LEVELS];       // renders by LOD, the last entry also counts coarser ones
+  uint64_t iRenderMinorFaults;                      // page faults during renders, on the rendering thread only
+  uint64_t iRenderMajorFaults;                      // faults that had to read from disk
+  uint64_t iColdSamples;                            // raw samples in cold storage, see SSG_SetColdStorage
+  uint64_t iColdBytes;                              // compressed size of the cold samples
+  uint64_t iColdCacheMisses;                        // cold blocks decompressed for reading
+} SSG_Stats;
+
+/**
+ * SSG_Options
+ * Settings for creating a graph. They are recorded in the file, so they only apply when the file is created.
+ * Zero-initialize and set the fields of interest, zero means default.
+ */
+typedef struct {
+  int iFanout; // LOD reduction factor 2, 4, 8 or 16. Default 2. Higher cuts LOD storage and ingest work
+               // (2x the raw data at 2, about 13% at 16), at the cost of rendering from up to fan-out/2 entries
+               // per lookup between the stored levels.
+  int iChannels; // Values per sample position, 1 to SSG_MAX_CHANNELS. Default 1. The channels share the time axis
+                 // and are stored interleaved, so a frame is appended and a column is read in one go.
+  int iSampleType; // SSG_SAMPLE_*. Default float. The compact types cut disk, page cache and memory traffic.
+  double dScale;   // Physical value = stored value * dScale + dOffset. Default 1, must be positive.
+  double dOffset;  // Added values are mapped back, rounded and saturated to fit an integer type.
+  int bTimestamps; // 1 to store a time with every frame, for irregularly sampled series. Default 0, where the time
+                   // of a frame is its index. Frames are then only added with SSG_AddTimedFrames.
+  uint64_t iRetainSamples; // Keep only the newest samples, 0 for all. Older ones are overwritten in place, so the
+                           // file stops growing. Positions stay absolute, see SSG_GetFirstSample.
+  uint64_t iRetainBytes;   // The same as a bound on the data in the file, converted to samples. The lower wins.
+  int bDensity;    // 1 to keep the mean and variance SSG_RenderDensity estimates the spread of values within a level
+                   // entry from, 16 bytes per channel for every 16 to 240 raw samples, depending on the fan-out.
+                   // Default 0.
+} SSG_Options;
 
 /**
  * SSG_New
  * Create a new graph object capable of receiving samples and rendering a graph as a bitmap.
+ * All data is stored in the container file <pcBasefilename>.ssg. If it does not exist but files in the older
+ * one-file-per-level layout do, a writable open converts them first, see SSG_ConvertMultiFile.
  * @param pcBasefilename Fully qualified base filename including path for long term storage
  * @param bWritable Map files for writing
- * @return SSG object
+ * @return SSG object, or NULL if the file can't be opened, is not a graph container, or is in the older layout
+ *         and either bWritable is 0 or the conversion failed
  */
 SSG *SSG_New(char *pcBasefilename, int bWritable);
 
+/**
+ * SSG_NewEx
+ * Like SSG_New, with settings for a graph file that does not exist yet.
+ * @param pcBasefilename Fully qualified base filename including path for long term storage
+ * @param bWritable Map files for writing
+ * @param pOptions Settings for a new file, or NULL for defaults
+ * @return SSG object, or NULL if the file can't be opened, is not a graph container or pOptions is invalid
+ */
+SSG *SSG_NewEx(char *pcBasefilename, int bWritable, const SSG_Options *pOptions);
+
 /**
  * SSG_Teardown
- * Destructor for graph object
+ * Destructor for graph object. A writable graph commits the samples added since the last commit first, which waits
+ * for the disk.
  * @param pThis SSG object
  */
 void SSG_Teardown(SSG* pThis);
 
 /**
  * SSG_AddValue
- * Append a sample at the end of the dataset.
+ * Append a sample at the end of the dataset. Single-channel graphs only, see SSG_AddFrame.
  * @param pThis SSG object
  * @param fValue Value to append
  */
 void SSG_AddValue(SSG *pThis, float fValue);
 
+/**
+ * SSG_AddValues
+ * Append a block of samples at the end of the dataset. Produces the same data as calling SSG_AddValue
+ * for each sample, but builds the LOD levels level by level over the block instead of per sample.
+ * @param pThis    SSG object
+ * @param pfValues Values to append
+ * @param iCount   Number of values
+ */
+void SSG_AddValues(SSG *pThis, const float *pfValues, size_t iCount);
+
+/**
+ * SSG_AddFrame
+ * Append one sample of every channel at the end of the dataset.
+ * @param pThis    SSG object
+ * @param pfValues One value per channel
+ */
+void SSG_AddFrame(SSG *pThis, const float *pfValues);
+
+/**
+ * SSG_AddFrames
+ * Append a block of frames at the end of the dataset, like SSG_AddValues. Values are in physical units and are
+ * converted to the sample type of the graph, see SSG_Options.
+ * @param pThis    SSG object
+ * @param pfValues Frames of one value per channel, frame after frame
+ * @param iFrames  Number of frames
+ */
+void SSG_AddFrames(SSG *pThis, const float *pfValues, size_t iFrames);
+
+/**
+ * SSG_AddRawFrames
+ * Append a block of frames already in the sample type of the graph, e.g. int16_t straight from an ADC.
+ * No scaling is applied, the values are stored as they are.
+ * @param pThis   SSG object
+ * @param pFrames Frames of one stored value per channel, frame after frame
+ * @param iFrames Number of frames
+ */
+void SSG_AddRawFrames(SSG *pThis, const void *pFrames, size_t iFrames);
+
+/**
+ * SSG_AddTimedFrames
+ * Append a block of frames with their times to a graph with timestamps, see SSG_Options. Times are in any unit,
+ * e.g. nanoseconds, and must not decrease. The untimed SSG_Add* calls do nothing on such a graph.
+ * @param pThis    SSG object, must be writable and have timestamps
+ * @param piTimes  Time of each frame
+ * @param pfValues Frames of one value per channel, frame after frame, in physical units
+ * @param iFrames  Number of frames
+ * @return 0 on success, -1 if the graph has no timestamps or a time is below the one before it
+ */
+int SSG_AddTimedFrames(SSG *pThis, const int64_t *piTimes, const float *pfValues, size_t iFrames);
+
+/**
+ * SSG_SetFrames
+ * Overwrite frames that were already added and repair the LOD levels over them, each level once for the whole
+ * block. Times are kept. Dropped frames, see SSG_Options, and frames in cold storage or older than the hot samples
+ * of SSG_SetColdStorage can't be edited. A commit makes the edit durable, e.g. SSG_Flush with bWait, the teardown
+ * or the flusher thread of SSG_SetAutoFlush. A crash during an edit or before the commit after it may leave the
+ * edited raw samples and the LOD levels over them disagreeing. SSG_RebuildLods brings the levels back in line.
+ * @param pThis    SSG object, must be writable
+ * @param iStart   Index of the first frame to overwrite
+ * @param pfValues Frames of one value per channel, frame after frame, in physical units
+ * @param iFrames  Number of frames
+ * @return 0 on success, -1 if the graph is read-only or a frame is not below the length or can't be edited
+ */
+int SSG_SetFrames(SSG *pThis, uint64_t iStart, const float *pfValues, size_t iFrames);
+
+/**
+ * SSG_SetValues
+ * Overwrite samples of a single channel graph, see SSG_SetFrames.
+ * @param pThis    SSG object, must be writable and have one channel
+ * @param iStart   Index of the first sample to overwrite
+ * @param pfValues New values
+ * @param iCount   Number of values
+ * @return 0 on success, -1 as for SSG_SetFrames or if the graph has more than one channel
+ */
+int SSG_SetValues(SSG *pThis, uint64_t iStart, const float *pfValues, size_t iCount);
+
+/**
+ * SSG_SetValue
+ * Overwrite one sample of a single channel graph, see SSG_SetFrames.
+ * @param pThis  SSG object, must be writable and have one channel
+ * @param iIndex Index of the sample
+ * @param fValue New value
+ * @return 0 on success, -1 as for SSG_SetValues
+ */
+int SSG_SetValue(SSG *pThis, uint64_t iIndex, float fValue);
+
+/**
+ * SSG_TimeToIndex
+ * Find the first frame at or after a time, in O(log n) over a per-block index of the times.
+ * @param pThis SSG object
+ * @param iTime Time to look up, the index itself for a graph without timestamps
+ * @return Index of the first frame with a time of at least iTime, the length if there is none
+ */
+uint64_t SSG_TimeToIndex(SSG *pThis, int64_t iTime);
+
+/**
+ * SSG_GetTime
+ * Get the time of a frame.
+ * @param pThis  SSG object
+ * @param iIndex Index of the frame
+ * @return Time of the frame, the index for a graph without timestamps, INT64_MIN if iIndex is not below the length
+ */
+int64_t SSG_GetTime(SSG *pThis, uint64_t iIndex);
+
+/**
+ * SSG_RebuildLods
+ * Regenerate all LOD levels from the raw samples, e.g. after the level data in the .ssg file was damaged.
+ * The raw range is split into chunks that are reduced in parallel. Reading calls running at the same time wait
+ * for it and see the levels from before or after it, and SSG_RenderCached redraws afterwards.
+ * @param pThis    SSG object, must be writable
+ * @param iThreads Number of threads to use, 0 for one per online CPU
+ * @return 0 on success, -1 if the graph is read-only
+ */
+int SSG_RebuildLods(SSG *pThis, int iThreads);
+
+/**
+ * SSG_Flush
+ * Commit the samples added so far. Adding samples never waits for the disk, and after a crash the graph opens with
+ * the length of the last commit: samples added after it are lost, the ones before it are intact. Commits happen
+ * here, in SSG_Teardown and on the flusher thread, see SSG_SetAutoFlush. With retention, the writer also commits before
+ * it would overwrite samples the last commit kept, which the flusher thread makes rare.
+ * @param pThis SSG object
+ * @param bWait 1 to commit, which returns once the samples are on disk, 0 to only start writeback
+ * @return 0 on success, -1 on an I/O error
+ */
+int SSG_Flush(SSG *pThis, int bWait);
+
+/**
+ * SSG_SetAutoFlush
+ * Commit in the background, which bounds what a crash can lose to about the interval or the byte threshold plus
+ * the time a commit takes. A thread of the graph commits every iIntervalMs if samples were added or edited, and
+ * the writer wakes it early once iBytes of raw samples added or rewritten are uncommitted. The writer itself never
+ * waits for it.
+ * @param pThis       SSG object, must be writable
+ * @param iIntervalMs Commit period in milliseconds, 0 for none
+ * @param iBytes      Uncommitted raw sample bytes that trigger a commit, 0 for none. Both 0 stops the thread.
+ * @return 0 on success, -1 if the graph is read-only or the thread can't be started
+ */
+int SSG_SetAutoFlush(SSG *pThis, int iIntervalMs, uint64_t iBytes);
+
+/**
+ * SSG_SetColdStorage
+ * Compress old raw samples in the background. A thread of the graph packs blocks of raw frames that are older
+ * than the newest iHotSamples, and gives the raw copies back to the file system once the packed blocks are on
+ * disk. Reads of cold raw samples decompress a block into a small cache, the LOD levels stay as they are.
+ * Compressed blocks stay compressed when this is turned off again.
+ * @param pThis       SSG object, must be writable
+ * @param bEnable     1 to start compressing, 0 to stop the thread
+ * @param iHotSamples Newest raw samples to keep uncompressed, at least one block of 1024
+ * @return 0 on success, -1 if the graph is read-only or has retention, or the thread can't be started
+ */
+int SSG_SetColdStorage(SSG *pThis, int bEnable, uint64_t iHotSamples);
+
+/**
+ * SSG_ConvertMultiFile
+ * Create the container file <pcBasefilename>.ssg from <pcBasefilename>_rawsamples.bin of the older layout with
+ * one file per level. The LOD levels are regenerated from the raw samples. The old files are left in place.
+ * @param pcBasefilename Fully qualified base filename including path
+ * @param pOptions Settings for the container, or NULL for defaults. The container always has one channel of
+ *                 unscaled floats, like the old files.
+ * @return 0 on success, -1 if there are no raw samples to convert or the container already exists
+ */
+int SSG_ConvertMultiFile(char *pcBasefilename, const SSG_Options *pOptions);
+
 /**
  * SSG_Length
- * Get number of added samples, in case the caller loses track. ;)
+ * Get number of added samples, in case the caller loses track. ;) From another thread than the writer, this is
+ * the length readers see: all samples up to it and their LOD levels are complete.
  * @param pThis
  * @return
  */
 uint64_t SSG_GetLength(SSG *pThis);
 
+/**
+ * SSG_GetFirstSample
+ * Get the position of the oldest sample still kept in a graph with retention, see SSG_Options. It moves up as
+ * samples are added, positions before it render like the ones before sample 0. Without retention it is 0.
+ * @param pThis SSG object
+ * @return Position of the first sample kept
+ */
+uint64_t SSG_GetFirstSample(SSG *pThis);
+
+/**
+ * SSG_GetChannels
+ * @param pThis SSG object
+ * @return Number of values per frame
+ */
+int SSG_GetChannels(SSG *pThis);
+
+/**
+ * SSG_GetSampleType
+ * @param pThis SSG object
+ * @return SSG_SAMPLE_* type of the stored values
+ */
+int SSG_GetSampleType(SSG *pThis);
+
+/**
+ * SSG_EnableStats
+ * Turn statistics collection on or off. It is off by default, and enabling it starts the counters from zero.
+ * The cost when enabled is a clock read per render, map and sync call, never per sample or column.
+ * @param pThis   SSG object
+ * @param bEnable 1 to collect statistics
+ */
+void SSG_EnableStats(SSG *pThis, int bEnable);
+
+/**
+ * SSG_GetStats
+ * Get runtime statistics. May be called from any thread.
+ * @param pThis  SSG object
+ * @param pStats Receives the statistics
+ */
+void SSG_GetStats(SSG *pThis, SSG_Stats *pStats);
+
+/**
+ * SSG_QueryRange
+ * Get min and max of every channel over a range of samples. Whole blocks are taken from the LOD levels and only
+ * the edges from finer levels, so the cost grows with the log of the range, not its length.
+ * @param pThis  SSG object
+ * @param iStart First sample of the range
+ * @param iEnd   Sample after the range, clamped to the length
+ * @param pfMin  Receives the minimum of each channel, in physical units
+ * @param pfMax  Receives the maximum of each channel, in physical units
+ * @return 0 on success, -1 if the range holds no samples
+ */
+int SSG_QueryRange(SSG *pThis, uint64_t iStart, uint64_t iEnd, float *pfMin, float *pfMax);
+
+/**
+ * SSG_AutoRange
+ * Fit the value range to the samples in a window, for the fTopmostValue and fBottommostValue of SSG_Render.
+ * The range covers all channels and is exact, add a margin as needed. A flat signal gets a range around it.
+ * @param pThis                    SSG object
+ * @param dLeftmostPixelSamplePos  Sample pos at left edge of buffer
+ * @param dRightmostPixelSamplePos Sample pos at right edge of buffer
+ * @param pfTopmostValue           Receives the highest value in the window
+ * @param pfBottommostValue        Receives the lowest value in the window
+ * @return 0 on success, -1 if the window holds no samples, the values are left unchanged then
+ */
+int SSG_AutoRange(SSG *pThis, double dLeftmostPixelSamplePos, double dRightmostPixelSamplePos, float *pfTopmostValue, float *pfBottommostValue);
+
 /**
  * SSG_Render
- * Renders the sample data into a receiving 8-bit luminance buffer.
+ * Renders the sample data into a receiving 8-bit luminance buffer. Multi-channel graphs are rendered overlaid.
  * @param pThis                    SSG object
  * @param dLeftmostPixelSamplePos  Sample pos at left edge of buffer
  * @param dRightmostPixelSamplePos Sample pos at right edge of buffer
@@ -75,4 +405,158 @@ uint64_t SSG_GetLength(SSG *pThis);
  */
 void SSG_Render(SSG* pThis, double dLeftmostPixelSamplePos, double dRightmostPixelSamplePos, float fTopmostValue, float fBottommostValue, uint8_t *pDstBuffer, int iWidth, int iHeight);
 
+/**
+ * SSG_RenderChannels
+ * Renders all channels in one pass over the viewport. The LOD and sample positions are worked out once per column
+ * and shared by the channels.
+ * @param pThis                    SSG object
+ * @param dLeftmostPixelSamplePos  Sample pos at left edge of buffer
+ * @param dRightmostPixelSamplePos Sample pos at right edge of buffer
+ * @param fTopmostValue            Function value at top of buffer, or of each lane when stacked
+ * @param fBottommostValue         Function value at bottom of buffer, or of each lane when stacked
+ * @param iLayout                  SSG_LAYOUT_OVERLAID or SSG_LAYOUT_STACKED
+ * @param pDstBuffer               Pointer to 8-bit buffer to receive pixels
+ * @param iWidth                   Width of destination buffer
+ * @param iHeight                  Height of destination buffer
+ */
+void SSG_RenderChannels(SSG* pThis, double dLeftmostPixelSamplePos, double dRightmostPixelSamplePos, float fTopmostValue, float fBottommostValue, int iLayout, uint8_t *pDstBuffer, int iWidth, int iHeight);
+
+/**
+ * SSG_RenderEnvelope
+ * Get the value range each column of SSG_Render covers instead of a bitmap, e.g. to send a graph over the wire
+ * or draw it with another renderer. The LOD selection and interpolation are the same as for SSG_Render, also
+ * outside the samples, where a stored zero is drawn.
+ * @param pThis                    SSG object
+ * @param dLeftmostPixelSamplePos  Sample pos at left edge of buffer
+ * @param dRightmostPixelSamplePos Sample pos at right edge of buffer
+ * @param iWidth                   Number of columns
+ * @param pfOutMin                 Receives the lowest value of each column, channel c of column x at c*iWidth+x
+ * @param pfOutMax                 Receives the highest value of each column, laid out like pfOutMin
+ */
+void SSG_RenderEnvelope(SSG* pThis, double dLeftmostPixelSamplePos, double dRightmostPixelSamplePos, int iWidth, float *pfOutMin, float *pfOutMax);
+
+/**
+ * SSG_RenderTime
+ * Renders a time window of the sample data, for graphs with timestamps, overlaid like SSG_Render. Each column
+ * covers an equal slice of time and draws the samples in it plus the lines to the neighbouring samples. Two
+ * samples further apart than iMaxGap are not connected, so missing data shows as a gap. The min and max of the
+ * samples in a column come from the LOD levels, so wide windows cost as little as with SSG_Render.
+ * @param pThis               SSG object
+ * @param iLeftmostPixelTime  Time at left edge of buffer
+ * @param iRightmostPixelTime Time at right edge of buffer
+ * @param fTopmostValue       Function value at top of buffer
+ * @param fBottommostValue    Function value at bottom of buffer
+ * @param iMaxGap             Longest time between two samples that are connected by a line
+ * @param pDstBuffer          Pointer to 8-bit buffer to receive pixels
+ * @param iWidth              Width of destination buffer
+ * @param iHeight             Height of destination buffer
+ */
+void SSG_RenderTime(SSG* pThis, int64_t iLeftmostPixelTime, int64_t iRightmostPixelTime, float fTopmostValue, float fBottommostValue, int64_t iMaxGap, uint8_t *pDstBuffer, int iWidth, int iHeight);
+
+/**
+ * SSG_RenderDensity
+ * Renders how the samples of each column are distributed over its rows instead of their min/max, like the
+ * persistence of an oscilloscope. A pixel is as bright as the share of its column's samples in its row, relative to
+ * the busiest row, so a noisy signal shows where it spends most of its time. Zoomed out, columns are made from a
+ * few level entries each and never from raw samples, so wide windows cost as little as with SSG_Render. Each entry
+ * is spread over its min/max, or more closely by its mean and variance in graphs created with bDensity.
+ * Multi-channel graphs are rendered overlaid.
+ * @param pThis                    SSG object
+ * @param dLeftmostPixelSamplePos  Sample pos at left edge of buffer
+ * @param dRightmostPixelSamplePos Sample pos at right edge of buffer
+ * @param fTopmostValue            Function value at top of buffer
+ * @param fBottommostValue         Function value at bottom of buffer
+ * @param pDstBuffer               Pointer to 8-bit buffer to receive pixels
+ * @param iWidth                   Width of destination buffer
+ * @param iHeight                  Height of destination buffer
+ */
+void SSG_RenderDensity(SSG* pThis, double dLeftmostPixelSamplePos, double dRightmostPixelSamplePos, float fTopmostValue, float fBottommostValue, uint8_t *pDstBuffer, int iWidth, int iHeight);
+
+/**
+ * SSG_Prefetch
+ * Start reading the pages a render of a range would read, without waiting for them. A render that follows soon
+ * after finds them in the page cache instead of faulting them in one at a time, e.g. before jumping to a bookmark.
+ * @param pThis  SSG object
+ * @param iStart First sample of the range
+ * @param iEnd   Sample after the range
+ * @param iLod   Zoom of the render, the log2 of its samples per pixel, 0 below one sample per pixel
+ */
+void SSG_Prefetch(SSG *pThis, uint64_t iStart, uint64_t iEnd, int iLod);
+
+/**
+ * SSG_SetPrefetch
+ * Prefetch around the rendered views in the background. After each render, a thread of the graph prefetches the
+ * views a user is likely to move to next: a screen to either side, and one zoom step in and out. Renders only hand
+ * it their view and never wait for it.
+ * @param pThis   SSG object
+ * @param bEnable 1 to start the thread, 0 to stop it
+ * @return 0 on success, -1 if the thread can't be started
+ */
+int SSG_SetPrefetch(SSG *pThis, int bEnable);
+
+/**
+ * SSG_WorkerPoolNew
+ * Create a pool of render threads. One pool can be shared by any number of graphs.
+ * @param iThreads Number of threads including the rendering caller, 0 for one per online CPU
+ * @return Worker pool
+ */
+SSG_WorkerPool *SSG_WorkerPoolNew(int iThreads);
+
+/**
+ * SSG_WorkerPoolTeardown
+ * Destructor for worker pool. Graphs using it must be detached or torn down first.
+ * @param pPool Worker pool
+ */
+void SSG_WorkerPoolTeardown(SSG_WorkerPool *pPool);
+
+/**
+ * SSG_SetWorkerPool
+ * Select tiled rendering: SSG_Render splits the viewport into column bands that are rendered in parallel
+ * into column-major tiles, and transposes them into the destination. Output is identical to the default mode.
+ * @param pThis SSG object
+ * @param pPool Worker pool to render on, or NULL for single-threaded rendering
+ */
+void SSG_SetWorkerPool(SSG *pThis, SSG_WorkerPool *pPool);
+
+/**
+ * SSG_RenderCacheNew
+ * Create a render cache for SSG_RenderCached. Use one cache per view.
+ * @return Render cache
+ */
+SSG_RenderCache *SSG_RenderCacheNew(void);
+
+/**
+ * SSG_RenderCacheTeardown
+ * Destructor for render cache
+ * @param pCache Render cache
+ */
+void SSG_RenderCacheTeardown(SSG_RenderCache *pCache);
+
+/**
+ * SSG_RenderCacheInvalidate
+ * Make the next SSG_RenderCached call redraw everything, e.g. after writing into the destination buffer.
+ * @param pCache Render cache
+ */
+void SSG_RenderCacheInvalidate(SSG_RenderCache *pCache);
+
+/**
+ * SSG_RenderCached
+ * Like SSG_Render, but only redraws what changed since the previous call with the same cache and destination buffer.
+ * The left edge is snapped to a whole pixel of a fixed grid, so panning at the same zoom scrolls the previous frame
+ * and renders only the exposed columns, and appended samples only redraw the columns that show them.
+ * Changing zoom, value range, size, graph or destination buffer redraws everything. Multi-channel graphs are
+ * always redrawn.
+ * pDstBuffer must still hold the previous frame, unmodified by the caller.
+ * @param pThis                    SSG object
+ * @param pCache                   Render cache
+ * @param dLeftmostPixelSamplePos  Sample pos at left edge of buffer
+ * @param dRightmostPixelSamplePos Sample pos at right edge of buffer
+ * @param fTopmostValue            Function value at top of buffer
+ * @param fBottommostValue         Function value at bottom of buffer
+ * @param pDstBuffer               Pointer to 8-bit buffer to receive pixels
+ * @param iWidth                   Width of destination buffer
+ * @param iHeight                  Height of destination buffer
+ */
+void SSG_RenderCached(SSG* pThis, SSG_RenderCache *pCache, double dLeftmostPixelSamplePos, double dRightmostPixelSamplePos, float fTopmostValue, float fBottommostValue, uint8_t *pDstBuffer, int iWidth, int iHeight);
+
 #endif //_SUBSAMPLEGRAPH_H